@@ -21,6 +21,7 @@ public:
     unsigned m_rarity;
     unsigned m_set;
     std::vector<SkillSpec> m_skills;
+    std::vector<SkillSpec> m_activation_skills;  // the activation skills of m_skills, in the same order
     unsigned m_skill_value[Skill::num_skills];
     CardType::CardType m_type;
     const Card* m_top_level_card; // [TU] corresponding full-level card
@@ -42,6 +43,7 @@ public:
         m_rarity(1),
         m_set(0),
         m_skills(),
+        m_activation_skills(),
         m_type(CardType::assault),
         m_top_level_card(this),
         m_recipe_cost(0),
@@ -52,7 +54,8 @@ public:
     }
 
     void add_skill(Skill::Skill id, unsigned x, Faction y, unsigned n, unsigned c, Skill::Skill s, Skill::Skill s2, bool all);
-    const Card* upgraded() const { return this == m_top_level_card ? this : m_used_for_cards.begin()->first; }
+    void set_activation_skills();
+    const Card* upgraded() const;
 };
 
 #endif
@@ -10,12 +10,17 @@
 #include "tyrant.h"
 #include "card.h"
 
+inline bool is_dropped_from_name(char c)
+{
+    return(strchr(";:,\"'! ", c) != nullptr);
+}
+
 std::string simplify_name(const std::string& card_name)
 {
     std::string simple_name;
     for(auto c : card_name)
     {
-        if(!strchr(";:,\"'! ", c))
+        if(!is_dropped_from_name(c))
         {
             simple_name += ::tolower(c);
         }
@@ -38,6 +43,90 @@ std::list<std::string> get_abbreviations(const std::string& name)
     return(abbr_list);
 }
 
+//------------------------------------------------------------------------------
+namespace {
+// FNV-1a over the characters of the simplified name
+template<typename Iterator> size_t hash_simple_name(Iterator it, Iterator it_end, bool simplify)
+{
+    size_t hash = 2166136261u;
+    for(; it != it_end; ++it)
+    {
+        if(simplify && is_dropped_from_name(*it)) { continue; }
+        hash = (hash ^ static_cast<unsigned char>(simplify ? ::tolower(*it) : *it)) * 16777619u;
+    }
+    return(hash);
+}
+}
+
+void CardNameIndex::clear()
+{
+    m_entries.clear();
+    m_slots.clear();
+}
+
+void CardNameIndex::build(const Cards & cards)
+{
+    // Abbreviations take precedence over card names; an abbreviation of a name that is not a card
+    // is left out, so the lookup falls back to the slow path which reports it.
+    std::map<std::string, Entry> entries;
+    for(const auto & it: cards.cards_by_name)
+    {
+        entries[it.first] = Entry{it.first, it.second, cards.ambiguous_names.count(it.first) > 0};
+    }
+    for(const auto & it: cards.player_cards_abbr)
+    {
+        std::string simple_name{simplify_name(it.second)};
+        auto card_it = cards.cards_by_name.find(simple_name);
+        if(card_it == cards.cards_by_name.end())
+        {
+            entries.erase(it.first);
+        }
+        else
+        {
+            entries[it.first] = Entry{it.first, card_it->second, cards.ambiguous_names.count(simple_name) > 0};
+        }
+    }
+    clear();
+    size_t num_slots = 16;
+    while(num_slots < entries.size() * 2) { num_slots *= 2; }
+    m_slots.assign(num_slots, 0);
+    m_entries.reserve(entries.size());
+    for(auto & it: entries)
+    {
+        m_entries.emplace_back(std::move(it.second));
+        const std::string & simple_name = m_entries.back().simple_name;
+        size_t slot = hash_simple_name(simple_name.begin(), simple_name.end(), false) & (num_slots - 1);
+        while(m_slots[slot] != 0) { slot = (slot + 1) & (num_slots - 1); }
+        m_slots[slot] = m_entries.size();
+    }
+}
+
+const CardNameIndex::Entry * CardNameIndex::find(boost::string_ref name) const
+{
+    if(m_slots.empty())
+    {
+        return(nullptr);
+    }
+    const size_t mask = m_slots.size() - 1;
+    for(size_t slot = hash_simple_name(name.begin(), name.end(), true) & mask; m_slots[slot] != 0; slot = (slot + 1) & mask)
+    {
+        const Entry & entry = m_entries[m_slots[slot] - 1];
+        auto entry_it = entry.simple_name.begin();
+        auto name_it = name.begin();
+        for(; name_it != name.end(); ++name_it)
+        {
+            if(is_dropped_from_name(*name_it)) { continue; }
+            if(entry_it == entry.simple_name.end() || *entry_it != static_cast<char>(::tolower(*name_it))) { break; }
+            ++entry_it;
+        }
+        if(name_it == name.end() && entry_it == entry.simple_name.end())
+        {
+            return(&entry);
+        }
+    }
+    return(nullptr);
+}
+
 //------------------------------------------------------------------------------
 Cards::~Cards()
 {
@@ -62,6 +151,7 @@ void Cards::organize()
     cards_by_id.clear();
     player_cards.clear();
     cards_by_name.clear();
+    name_index.clear();
     player_commanders.clear();
     player_assaults.clear();
     player_structures.clear();
@@ -169,5 +259,32 @@ void Card::add_skill(Skill::Skill id, unsigned x, Faction y, unsigned n, unsigne
     }
     m_skills.push_back({id, x, y, n, c, s, s2, all});
     m_skill_value[id] = x ? x : n ? n : 1;
+    set_activation_skills();
+}
+
+void Card::set_activation_skills()
+{
+    m_activation_skills.clear();
+    for (const auto & ss: m_skills)
+    {
+        if (is_activation_skill(ss.id))
+        {
+            m_activation_skills.push_back(ss);
+        }
+    }
+}
+
+// The next level of the card. m_used_for_cards also holds the fusions the card is a recipe of, in pointer order,
+// so the next level is told apart by its level within the same upgrade chain. The top level card is its own next level.
+const Card* Card::upgraded() const
+{
+    const Card* next_level = this;
+    for (const auto & used_for: m_used_for_cards)
+    {
+        const Card* card = used_for.first;
+        if (card->m_top_level_card == m_top_level_card && card->m_level > m_level && (next_level == this || card->m_level < next_level->m_level))
+        { next_level = card; }
+    }
+    return next_level;
 }
 
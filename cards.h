@@ -1,12 +1,34 @@
 #ifndef CARDS_H_INCLUDED
 #define CARDS_H_INCLUDED
 
+#include <boost/utility/string_ref.hpp>
 #include <map>
 #include <string>
 #include <unordered_set>
 #include <vector>
 
 class Card;
+class Cards;
+
+// Hash index from simplified card names and abbreviations to cards. Names are simplified
+// while they are hashed and compared, so a lookup does not build any string.
+class CardNameIndex
+{
+public:
+    struct Entry
+    {
+        std::string simple_name;
+        const Card * card;
+        bool ambiguous;
+    };
+    void clear();
+    void build(const Cards & cards);
+    const Entry * find(boost::string_ref name) const;
+
+private:
+    std::vector<Entry> m_entries;
+    std::vector<unsigned> m_slots;  // index + 1 into m_entries; 0 if empty
+};
 
 class Cards
 {
@@ -23,6 +45,7 @@ public:
     std::map<std::string, std::string> player_cards_abbr;
     std::unordered_set<unsigned> visible_cardset;
     std::unordered_set<std::string> ambiguous_names;
+    CardNameIndex name_index;  // built from cards_by_name and player_cards_abbr once both are complete
     const Card * by_id(unsigned id) const;
     void organize();
     void add_card(Card * card, const std::string & name);
@@ -0,0 +1,382 @@
+#include "db.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+
+#include "tyrant.h"
+#include "card.h"
+#include "cards.h"
+#include "deck.h"
+
+//---------------------- Binary card database ----------------------------------
+// Layout: header (magic, version, sizes of the enums, source files with their size and mtime),
+// then cards, card lists and name indexes, then decks and deck indexes.
+// Cards and decks refer to each other by their index in Cards::all_cards and Decks::decks.
+namespace {
+const char db_magic[8] = {'T', 'U', 'O', 'D', 'B', 0, 0, 0};
+const uint32_t db_version = 1;
+const uint32_t no_index = UINT32_MAX;
+
+struct SourceStamp
+{
+    uint64_t size;
+    int64_t mtime;
+};
+
+SourceStamp source_stamp(const std::string & filename)
+{
+    boost::system::error_code ec;
+    uint64_t size = boost::filesystem::file_size(filename, ec);
+    if (ec)
+    { return {UINT64_MAX, 0}; } // missing file: the database is stale once it appears
+    int64_t mtime = boost::filesystem::last_write_time(filename, ec);
+    return {size, ec ? 0 : mtime};
+}
+
+class DbWriter
+{
+public:
+    std::ofstream & os;
+    explicit DbWriter(std::ofstream & os_) : os(os_) {}
+    void u32(uint32_t value) { os.write(reinterpret_cast<const char*>(&value), sizeof value); }
+    void u64(uint64_t value) { os.write(reinterpret_cast<const char*>(&value), sizeof value); }
+    void str(const std::string & value) { u32(value.size()); os.write(value.data(), value.size()); }
+};
+
+class DbReader
+{
+public:
+    const char* pos;
+    const char* end;
+    DbReader(const char* begin_, const char* end_) : pos(begin_), end(end_) {}
+    const char* take(size_t size)
+    {
+        if (size > (size_t)(end - pos))
+        { throw std::runtime_error("truncated database"); }
+        const char* data = pos;
+        pos += size;
+        return data;
+    }
+    uint32_t u32() { uint32_t value; memcpy(&value, take(sizeof value), sizeof value); return value; }
+    uint64_t u64() { uint64_t value; memcpy(&value, take(sizeof value), sizeof value); return value; }
+    std::string str() { uint32_t size = u32(); return std::string(take(size), size); }
+};
+
+void write_header(DbWriter & w, const std::vector<std::string> & source_files)
+{
+    w.os.write(db_magic, sizeof db_magic);
+    w.u32(db_version);
+    w.u32(Skill::num_skills);
+    w.u32(sizeof(Card));
+    w.u32(source_files.size());
+    for (const auto & filename: source_files)
+    {
+        auto stamp = source_stamp(filename);
+        w.str(filename);
+        w.u64(stamp.size);
+        w.u64(stamp.mtime);
+    }
+}
+
+bool check_header(DbReader & r, const std::vector<std::string> & source_files)
+{
+    if (memcmp(r.take(sizeof db_magic), db_magic, sizeof db_magic) != 0 || r.u32() != db_version ||
+            r.u32() != Skill::num_skills || r.u32() != sizeof(Card) || r.u32() != source_files.size())
+    { return false; }
+    for (const auto & filename: source_files)
+    {
+        auto stamp = source_stamp(filename);
+        if (r.str() != filename || r.u64() != stamp.size || (int64_t)r.u64() != stamp.mtime)
+        { return false; }
+    }
+    return true;
+}
+
+void clear_cards_and_decks(Cards & all_cards, Decks & decks)
+{
+    decks.decks.clear();
+    decks.by_name.clear();
+    decks.by_type_id.clear();
+    for (Card* card: all_cards.all_cards) { delete(card); }
+    all_cards.all_cards.clear();
+    all_cards.cards_by_id.clear();
+    all_cards.player_cards.clear();
+    all_cards.cards_by_name.clear();
+    all_cards.name_index.clear();
+    all_cards.player_commanders.clear();
+    all_cards.player_assaults.clear();
+    all_cards.player_structures.clear();
+    all_cards.visible_cardset.clear();
+    all_cards.ambiguous_names.clear();
+}
+}
+
+//------------------------------------------------------------------------------
+void save_card_db(const Cards& all_cards, const Decks& decks, const std::string & filename, const std::vector<std::string> & source_files)
+{
+    std::map<const Card*, uint32_t> card_index{{nullptr, no_index}};
+    for (const Card* card: all_cards.all_cards)
+    { card_index.emplace(card, card_index.size() - 1); }
+    std::map<const Deck*, uint32_t> deck_index;
+    for (const Deck & deck: decks.decks)
+    { deck_index.emplace(&deck, deck_index.size()); }
+
+    // write to a temporary file first so that concurrent runs never map a partial database
+    std::string tmp_filename = filename + ".tmp";
+    {
+        std::ofstream os(tmp_filename, std::ios::binary | std::ios::trunc);
+        if (!os.good())
+        { throw std::runtime_error("Cannot write " + tmp_filename); }
+        DbWriter w(os);
+        auto write_cards = [&](const std::vector<const Card*> & cards)
+        {
+            w.u32(cards.size());
+            for (const Card* card: cards) { w.u32(card_index.at(card)); }
+        };
+        auto write_card_map = [&](const std::map<const Card*, unsigned> & cards)
+        {
+            w.u32(cards.size());
+            for (const auto & it: cards) { w.u32(card_index.at(it.first)); w.u32(it.second); }
+        };
+        write_header(w, source_files);
+
+        // cards
+        w.u32(all_cards.all_cards.size());
+        for (const Card* card: all_cards.all_cards)
+        {
+            w.u32(card->m_attack);
+            w.u32(card->m_base_id);
+            w.u32(card->m_delay);
+            w.u32(card->m_faction);
+            w.u32(card->m_health);
+            w.u32(card->m_id);
+            w.u32(card->m_level);
+            w.u32(card->m_fusion_level);
+            w.str(card->m_name);
+            w.u32(card->m_rarity);
+            w.u32(card->m_set);
+            w.u32(card->m_skills.size());
+            for (const auto & ss: card->m_skills)
+            {
+                w.u32(ss.id); w.u32(ss.x); w.u32(ss.y); w.u32(ss.n); w.u32(ss.c); w.u32(ss.s); w.u32(ss.s2); w.u32(ss.all);
+            }
+            w.os.write(reinterpret_cast<const char*>(card->m_skill_value), sizeof card->m_skill_value);
+            w.u32(card->m_type);
+            w.u32(card_index.at(card->m_top_level_card));
+            w.u32(card->m_recipe_cost);
+        }
+        for (const Card* card: all_cards.all_cards)
+        {
+            write_card_map(card->m_recipe_cards);
+            write_card_map(card->m_used_for_cards);
+        }
+        w.u32(all_cards.cards_by_id.size());
+        for (const auto & it: all_cards.cards_by_id) { w.u32(it.first); w.u32(card_index.at(it.second)); }
+        write_cards({all_cards.player_cards.begin(), all_cards.player_cards.end()});
+        write_cards({all_cards.player_commanders.begin(), all_cards.player_commanders.end()});
+        write_cards({all_cards.player_assaults.begin(), all_cards.player_assaults.end()});
+        write_cards({all_cards.player_structures.begin(), all_cards.player_structures.end()});
+        w.u32(all_cards.cards_by_name.size());
+        for (const auto & it: all_cards.cards_by_name) { w.str(it.first); w.u32(card_index.at(it.second)); }
+        w.u32(all_cards.visible_cardset.size());
+        for (unsigned set: all_cards.visible_cardset) { w.u32(set); }
+        w.u32(all_cards.ambiguous_names.size());
+        for (const auto & name: all_cards.ambiguous_names) { w.str(name); }
+
+        // decks
+        w.u32(decks.decks.size());
+        for (const Deck & deck: decks.decks)
+        {
+            w.u32(deck.decktype);
+            w.u32(deck.id);
+            w.str(deck.name);
+            w.u32(deck.upgrade_points);
+            w.u32(deck.upgrade_opportunities);
+            w.u32(deck.strategy);
+            w.u32(card_index.at(deck.commander));
+            w.u32(deck.commander_max_level);
+            write_cards(deck.cards);
+            w.u32(deck.variable_cards.size());
+            for (const auto & pool: deck.variable_cards)
+            {
+                w.u32(std::get<0>(pool));
+                w.u32(std::get<1>(pool));
+                write_cards(std::get<2>(pool));
+            }
+            w.u32(deck.deck_size);
+            w.u32(deck.mission_req);
+            write_cards(deck.fort_cards);
+        }
+        w.u32(decks.by_name.size());
+        for (const auto & it: decks.by_name) { w.str(it.first); w.u32(deck_index.at(it.second)); }
+        w.u32(decks.by_type_id.size());
+        for (const auto & it: decks.by_type_id) { w.u32(it.first.first); w.u32(it.first.second); w.u32(deck_index.at(it.second)); }
+        if (!os.good())
+        { throw std::runtime_error("Cannot write " + tmp_filename); }
+    }
+    boost::filesystem::rename(tmp_filename, filename);
+}
+
+//------------------------------------------------------------------------------
+// Return false (leaving all_cards and decks empty) if the database is missing, stale or broken.
+bool load_card_db(Cards& all_cards, Decks& decks, const std::string & filename, const std::vector<std::string> & source_files)
+{
+    if (!boost::filesystem::exists(filename))
+    { return false; }
+    try
+    {
+        boost::interprocess::file_mapping mapping(filename.c_str(), boost::interprocess::read_only);
+        boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+        const char* begin = static_cast<const char*>(region.get_address());
+        DbReader r(begin, begin + region.get_size());
+        if (!check_header(r, source_files))
+        { return false; }
+        std::vector<Card*> cards_by_index;
+        std::vector<uint32_t> top_level_card_index;
+        auto card_at = [&](uint32_t index) -> Card*
+        {
+            if (index == no_index) { return nullptr; }
+            if (index >= cards_by_index.size()) { throw std::runtime_error("bad card index"); }
+            return cards_by_index[index];
+        };
+        auto read_cards = [&](std::vector<const Card*> & cards)
+        {
+            cards.resize(r.u32());
+            for (auto && card: cards) { card = card_at(r.u32()); }
+        };
+        auto read_player_cards = [&](std::vector<Card*> & cards)
+        {
+            cards.resize(r.u32());
+            for (auto && card: cards) { card = card_at(r.u32()); }
+        };
+        auto read_card_map = [&](std::map<const Card*, unsigned> & cards)
+        {
+            for (uint32_t i = r.u32(); i > 0; -- i)
+            {
+                const Card* card = card_at(r.u32());
+                cards[card] = r.u32();
+            }
+        };
+
+        // cards
+        for (uint32_t i = r.u32(); i > 0; -- i)
+        {
+            Card* card = new Card();
+            all_cards.all_cards.push_back(card);
+            cards_by_index.push_back(card);
+            card->m_attack = r.u32();
+            card->m_base_id = r.u32();
+            card->m_delay = r.u32();
+            card->m_faction = static_cast<Faction>(r.u32());
+            card->m_health = r.u32();
+            card->m_id = r.u32();
+            card->m_level = r.u32();
+            card->m_fusion_level = r.u32();
+            card->m_name = r.str();
+            card->m_rarity = r.u32();
+            card->m_set = r.u32();
+            card->m_skills.resize(r.u32());
+            for (auto && ss: card->m_skills)
+            {
+                ss.id = static_cast<Skill::Skill>(r.u32());
+                ss.x = r.u32();
+                ss.y = static_cast<Faction>(r.u32());
+                ss.n = r.u32();
+                ss.c = r.u32();
+                ss.s = static_cast<Skill::Skill>(r.u32());
+                ss.s2 = static_cast<Skill::Skill>(r.u32());
+                ss.all = r.u32();
+            }
+            card->set_activation_skills();
+            memcpy(card->m_skill_value, r.take(sizeof card->m_skill_value), sizeof card->m_skill_value);
+            card->m_type = static_cast<CardType::CardType>(r.u32());
+            top_level_card_index.push_back(r.u32());  // resolved once all cards exist
+            card->m_recipe_cost = r.u32();
+        }
+        for (size_t i = 0; i < cards_by_index.size(); ++ i)
+        {
+            Card* card = cards_by_index[i];
+            card->m_top_level_card = card_at(top_level_card_index[i]);
+            read_card_map(card->m_recipe_cards);
+            read_card_map(card->m_used_for_cards);
+        }
+        for (uint32_t i = r.u32(); i > 0; -- i)
+        {
+            unsigned id = r.u32();
+            all_cards.cards_by_id[id] = card_at(r.u32());
+        }
+        read_player_cards(all_cards.player_cards);
+        read_player_cards(all_cards.player_commanders);
+        read_player_cards(all_cards.player_assaults);
+        read_player_cards(all_cards.player_structures);
+        for (uint32_t i = r.u32(); i > 0; -- i)
+        {
+            std::string name = r.str();
+            all_cards.cards_by_name[name] = card_at(r.u32());
+        }
+        for (uint32_t i = r.u32(); i > 0; -- i)
+        { all_cards.visible_cardset.insert(r.u32()); }
+        for (uint32_t i = r.u32(); i > 0; -- i)
+        { all_cards.ambiguous_names.insert(r.str()); }
+
+        // decks
+        std::vector<Deck*> decks_by_index;
+        auto deck_at = [&](uint32_t index) -> Deck*
+        {
+            if (index >= decks_by_index.size()) { throw std::runtime_error("bad deck index"); }
+            return decks_by_index[index];
+        };
+        for (uint32_t i = r.u32(); i > 0; -- i)
+        {
+            auto decktype = static_cast<DeckType::DeckType>(r.u32());
+            unsigned id = r.u32();
+            std::string name = r.str();
+            unsigned upgrade_points = r.u32();
+            unsigned upgrade_opportunities = r.u32();
+            auto strategy = static_cast<DeckStrategy::DeckStrategy>(r.u32());
+            decks.decks.push_back(Deck{all_cards, decktype, id, name, upgrade_points, upgrade_opportunities, strategy});
+            Deck* deck = &decks.decks.back();
+            decks_by_index.push_back(deck);
+            deck->commander = card_at(r.u32());
+            deck->commander_max_level = r.u32();
+            read_cards(deck->cards);
+            deck->variable_cards.resize(r.u32());
+            for (auto && pool: deck->variable_cards)
+            {
+                std::get<0>(pool) = r.u32();
+                std::get<1>(pool) = r.u32();
+                read_cards(std::get<2>(pool));
+            }
+            deck->deck_size = r.u32();
+            deck->mission_req = r.u32();
+            read_cards(deck->fort_cards);
+        }
+        for (uint32_t i = r.u32(); i > 0; -- i)
+        {
+            std::string name = r.str();
+            decks.by_name[name] = deck_at(r.u32());
+        }
+        for (uint32_t i = r.u32(); i > 0; -- i)
+        {
+            auto decktype = static_cast<DeckType::DeckType>(r.u32());
+            unsigned id = r.u32();
+            decks.by_type_id[{decktype, id}] = deck_at(r.u32());
+        }
+        if (r.pos != r.end)
+        { throw std::runtime_error("trailing data"); }
+    }
+    catch (const std::exception & e)
+    {
+        std::cerr << "Warning: Cannot load card database " << filename << ": " << e.what() << ". Reading the XML files instead.\n";
+        clear_cards_and_decks(all_cards, decks);
+        return false;
+    }
+    return true;
+}
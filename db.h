@@ -0,0 +1,15 @@
+#ifndef DB_H_INCLUDED
+#define DB_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+class Cards;
+class Decks;
+
+// Precompiled card database: the organized cards, recipes and mission/raid/campaign decks,
+// valid as long as none of the source files has changed.
+bool load_card_db(Cards& all_cards, Decks& decks, const std::string & filename, const std::vector<std::string> & source_files);
+void save_card_db(const Cards& all_cards, const Decks& decks, const std::string & filename, const std::vector<std::string> & source_files);
+
+#endif
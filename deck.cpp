@@ -2,8 +2,10 @@
 
 #include <boost/range/algorithm_ext/insert.hpp>
 #include <boost/tokenizer.hpp>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <numeric>
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
@@ -38,10 +40,44 @@ const char* base64_chars =
     "0123456789+/";
 const char* wmt_b64_magic_chars = "-.~!*";
 
+std::string deckcodec_names[DeckCodec::num_deckcodecs]{"ext_b64", "wmt_b64", "ddd_b64", };
+DeckCodec::DeckCodec deck_codec = DeckCodec::ext_b64;
+
+namespace {
+// base64_index[c]: index of c in base64_chars, or 64 if c is not a base64 character
+struct Base64Index
+{
+    unsigned char index[256];
+    Base64Index()
+    {
+        std::fill(index, index + 256, 64);
+        for (unsigned i = 0; i < 64; ++ i) { index[static_cast<unsigned char>(base64_chars[i])] = i; }
+    }
+    unsigned operator[](char c) const { return index[static_cast<unsigned char>(c)]; }
+};
+const Base64Index base64_index;
+
+inline unsigned base64_digit(char c)
+{
+    unsigned d = base64_index[c];
+    if (d >= 64)
+    { throw std::runtime_error("Invalid hash character"); }
+    return d;
+}
+
+// Appends id to ids, which has room for max_ids.
+inline void push_id(unsigned* ids, size_t& num_ids, size_t max_ids, unsigned id)
+{
+    if (num_ids >= max_ids)
+    { throw std::runtime_error("Too many cards in hash"); }
+    ids[num_ids ++] = id;
+}
+
 // Converts cards in `hash' to a deck.
 // Stores resulting card IDs in `ids'.
-void hash_to_ids_wmt_b64(const char* hash, std::vector<unsigned>& ids)
+size_t hash_to_ids_wmt_b64(const char* hash, unsigned* ids, size_t max_ids)
 {
+    size_t num_ids = 0;
     unsigned int last_id = 0;
     const char* pc = hash;
 
@@ -58,53 +94,42 @@ void hash_to_ids_wmt_b64(const char* hash, std::vector<unsigned>& ids)
         {
             throw std::runtime_error("Invalid hash length");
         }
-        const char* p0 = strchr(base64_chars, *pc);
-        const char* p1 = strchr(base64_chars, *(pc + 1));
-        if (!p0 || !p1)
-        {
-            throw std::runtime_error("Invalid hash character");
-        }
+        unsigned int id = (base64_digit(*pc) << 6) + base64_digit(*(pc + 1));
         pc += 2;
-        size_t index0 = p0 - base64_chars;
-        size_t index1 = p1 - base64_chars;
-        unsigned int id = (index0 << 6) + index1;
 
         if (id < 4001)
         {
             id += id_plus;
-            ids.push_back(id);
+            push_id(ids, num_ids, max_ids, id);
             last_id = id;
         }
         else for (unsigned int j = 0; j < id - 4001; ++j)
         {
-            ids.push_back(last_id);
+            push_id(ids, num_ids, max_ids, last_id);
         }
     }
+    return num_ids;
 }
 
-void encode_id_wmt_b64(std::stringstream &ios, unsigned card_id)
+inline char* encode_id_wmt_b64(char* pc, unsigned card_id)
 {
     if(card_id > 4000)
     {
-        ios << wmt_b64_magic_chars[(card_id - 1) / 4000 - 1];
+        *pc++ = wmt_b64_magic_chars[(card_id - 1) / 4000 - 1];
         card_id = (card_id - 1) % 4000 + 1;
     }
-    ios << base64_chars[card_id / 64];
-    ios << base64_chars[card_id % 64];
+    *pc++ = base64_chars[card_id / 64];
+    *pc++ = base64_chars[card_id % 64];
+    return pc;
 }
 
-void encode_deck_wmt_b64(std::stringstream &ios, const Card* commander, std::vector<const Card*> cards)
+char* encode_ids_wmt_b64(char* pc, const unsigned* ids, size_t num_ids)
 {
-    if (commander)
-    {
-        encode_id_wmt_b64(ios, commander->m_id);
-    }
     unsigned last_id = 0;
     unsigned num_repeat = 0;
-    for(const Card* card: cards)
+    for(const unsigned* id = ids; id != ids + num_ids; ++ id)
     {
-        auto card_id = card->m_id;
-        if(card_id == last_id)
+        if(*id == last_id)
         {
             ++ num_repeat;
         }
@@ -112,72 +137,63 @@ void encode_deck_wmt_b64(std::stringstream &ios, const Card* commander, std::vec
         {
             if(num_repeat > 1)
             {
-                ios << base64_chars[(num_repeat + 4000) / 64];
-                ios << base64_chars[(num_repeat + 4000) % 64];
+                *pc++ = base64_chars[(num_repeat + 4000) / 64];
+                *pc++ = base64_chars[(num_repeat + 4000) % 64];
             }
-            last_id = card_id;
+            last_id = *id;
             num_repeat = 1;
-            encode_id_wmt_b64(ios, card_id);
+            pc = encode_id_wmt_b64(pc, *id);
         }
     }
     if(num_repeat > 1)
     {
-        ios << base64_chars[(num_repeat + 4000) / 64];
-        ios << base64_chars[(num_repeat + 4000) % 64];
+        *pc++ = base64_chars[(num_repeat + 4000) / 64];
+        *pc++ = base64_chars[(num_repeat + 4000) % 64];
     }
+    return pc;
 }
 
-void hash_to_ids_ext_b64(const char* hash, std::vector<unsigned>& ids)
+size_t hash_to_ids_ext_b64(const char* hash, unsigned* ids, size_t max_ids)
 {
+    size_t num_ids = 0;
     const char* pc = hash;
     while (*pc)
     {
         unsigned id = 0;
         unsigned factor = 1;
-        const char* p = strchr(base64_chars, *pc);
-        if (!p)
-        { throw std::runtime_error("Invalid hash character"); }
-        size_t d = p - base64_chars;
+        unsigned d = base64_digit(*pc);
         while (d < 32)
         {
             id += factor * d;
             factor *= 32;
             ++ pc;
-            p = strchr(base64_chars, *pc);
-            if (!p)
-            { throw std::runtime_error("Invalid hash character"); }
-            d = p - base64_chars;
+            d = base64_digit(*pc);
         }
         id += factor * (d - 32);
         ++ pc;
-        ids.push_back(id);
-    }
-}
-
-void encode_id_ext_b64(std::stringstream &ios, unsigned card_id)
-{
-    while (card_id >= 32)
-    {
-        ios << base64_chars[card_id % 32];
-        card_id /= 32;
+        push_id(ids, num_ids, max_ids, id);
     }
-    ios << base64_chars[card_id + 32];
+    return num_ids;
 }
 
-void encode_deck_ext_b64(std::stringstream &ios, const Card* commander, std::vector<const Card*> cards)
+char* encode_ids_ext_b64(char* pc, const unsigned* ids, size_t num_ids)
 {
-    if (commander)
-    {
-        encode_id_ext_b64(ios, commander->m_id);
-    }
-    for (const Card* card: cards)
+    for (const unsigned* id = ids; id != ids + num_ids; ++ id)
     {
-        encode_id_ext_b64(ios, card->m_id);
+        unsigned card_id = *id;
+        while (card_id >= 32)
+        {
+            *pc++ = base64_chars[card_id % 32];
+            card_id /= 32;
+        }
+        *pc++ = base64_chars[card_id + 32];
     }
+    return pc;
 }
 
-void hash_to_ids_ddd_b64(const char* hash, std::vector<unsigned>& ids)
+size_t hash_to_ids_ddd_b64(const char* hash, unsigned* ids, size_t max_ids)
 {
+    size_t num_ids = 0;
     const char* pc = hash;
     while(*pc)
     {
@@ -185,43 +201,65 @@ void hash_to_ids_ddd_b64(const char* hash, std::vector<unsigned>& ids)
         {
             throw std::runtime_error("Invalid hash length");
         }
-        const char* p0 = strchr(base64_chars, *pc);
-        const char* p1 = strchr(base64_chars, *(pc + 1));
-        const char* p2 = strchr(base64_chars, *(pc + 2));
-        if (!p0 || !p1 || !p2)
-        {
-            throw std::runtime_error("Invalid hash character");
-        }
+        unsigned int id = (base64_digit(*pc) << 12) + (base64_digit(*(pc + 1)) << 6) + base64_digit(*(pc + 2));
         pc += 3;
-        size_t index0 = p0 - base64_chars;
-        size_t index1 = p1 - base64_chars;
-        size_t index2 = p2 - base64_chars;
-        unsigned int id = (index0 << 12) + (index1 << 6) + index2;
-        ids.push_back(id);
+        push_id(ids, num_ids, max_ids, id);
     }
+    return num_ids;
 }
 
-void encode_id_ddd_b64(std::stringstream &ios, unsigned card_id)
+char* encode_ids_ddd_b64(char* pc, const unsigned* ids, size_t num_ids)
 {
-    ios << base64_chars[card_id / 4096];
-    ios << base64_chars[card_id % 4096 / 64];
-    ios << base64_chars[card_id % 64];
+    for (const unsigned* id = ids; id != ids + num_ids; ++ id)
+    {
+        *pc++ = base64_chars[*id / 4096];
+        *pc++ = base64_chars[*id % 4096 / 64];
+        *pc++ = base64_chars[*id % 64];
+    }
+    return pc;
+}
 }
 
-void encode_deck_ddd_b64(std::stringstream &ios, const Card* commander, std::vector<const Card*> cards)
+size_t encode_ids(DeckCodec::DeckCodec codec, char* buffer, const unsigned* ids, size_t num_ids)
 {
-    if (commander)
+    char* end = buffer;
+    switch (codec)
     {
-        encode_id_ddd_b64(ios, commander->m_id);
+    case DeckCodec::ext_b64: end = encode_ids_ext_b64(buffer, ids, num_ids); break;
+    case DeckCodec::wmt_b64: end = encode_ids_wmt_b64(buffer, ids, num_ids); break;
+    case DeckCodec::ddd_b64: end = encode_ids_ddd_b64(buffer, ids, num_ids); break;
+    case DeckCodec::num_deckcodecs: throw codec;
     }
-    for (const Card* card: cards)
+    *end = '\0';
+    return end - buffer;
+}
+
+size_t decode_hash(DeckCodec::DeckCodec codec, const char* hash, unsigned* ids, size_t max_ids)
+{
+    switch (codec)
     {
-        encode_id_ddd_b64(ios, card->m_id);
+    case DeckCodec::ext_b64: return hash_to_ids_ext_b64(hash, ids, max_ids);
+    case DeckCodec::wmt_b64: return hash_to_ids_wmt_b64(hash, ids, max_ids);
+    case DeckCodec::ddd_b64: return hash_to_ids_ddd_b64(hash, ids, max_ids);
+    case DeckCodec::num_deckcodecs: throw codec;
     }
+    return 0;
 }
 
-DeckDecoder hash_to_ids = hash_to_ids_ext_b64;
-DeckEncoder encode_deck = encode_deck_ext_b64;
+void hash_to_ids(const char* hash, std::vector<unsigned>& ids)
+{
+    size_t max_ids = max_ids_in_hash(deck_codec, strlen(hash));
+    if (max_ids <= max_decoded_ids)
+    {
+        unsigned decoded_ids[max_decoded_ids];
+        size_t num_ids = decode_hash(deck_codec, hash, decoded_ids, max_decoded_ids);
+        ids.insert(ids.end(), decoded_ids, decoded_ids + num_ids);
+        return;
+    }
+    std::vector<unsigned> decoded_ids(max_ids);
+    size_t num_ids = decode_hash(deck_codec, hash, decoded_ids.data(), max_ids);
+    ids.insert(ids.end(), decoded_ids.begin(), decoded_ids.begin() + num_ids);
+}
 
 namespace range = boost::range;
 
@@ -323,20 +361,39 @@ void Deck::add_forts(const std::string& deck_string)
     }
 }
 
-std::string Deck::hash() const
+size_t Deck::hash(char* buffer) const
 {
-    std::stringstream ios;
-    if (strategy == DeckStrategy::random)
+    // the ids of small decks are sorted on the stack
+    unsigned local_ids[32];
+    std::vector<unsigned> heap_ids;
+    size_t num_ids = cards.size() + (commander ? 1 : 0);
+    unsigned* ids = local_ids;
+    if (num_ids > 32)
     {
-        auto sorted_cards = cards;
-        std::sort(sorted_cards.begin(), sorted_cards.end(), [](const Card* a, const Card* b) { return a->m_id < b->m_id; });
-        encode_deck(ios, commander, sorted_cards);
+        heap_ids.resize(num_ids);
+        ids = heap_ids.data();
     }
-    else
+    unsigned* card_ids = ids;
+    if (commander)
     {
-        encode_deck(ios, commander, cards);
+        *card_ids++ = commander->m_id;
     }
-    return ios.str();
+    for (unsigned i = 0; i < cards.size(); ++ i)
+    {
+        card_ids[i] = cards[i]->m_id;
+    }
+    if (strategy == DeckStrategy::random)
+    {
+        std::sort(card_ids, ids + num_ids);
+    }
+    return encode_ids(deck_codec, buffer, ids, num_ids);
+}
+
+std::string Deck::hash() const
+{
+    std::string hash(max_hash_length(cards.size() + 1), '\0');
+    hash.resize(this->hash(&hash[0]));
+    return hash;
 }
 
 std::string Deck::short_description() const
@@ -474,6 +531,7 @@ const Card* Deck::next()
     {
         const Card* card = shuffled_cards.front();
         shuffled_cards.pop_front();
+        if(track_positions) { shuffled_positions.pop_front(); }
         return(card);
     }
     else if(strategy == DeckStrategy::ordered)
@@ -499,6 +557,7 @@ const Card* Deck::next()
                                              }
                                          });
         auto card = *cardIter;
+        if(track_positions) { shuffled_positions.erase(shuffled_positions.begin() + (cardIter - shuffled_cards.begin())); }
         shuffled_cards.erase(cardIter);
         auto card_order = order.find(card->m_id);
         if(!card_order->second.empty())
@@ -579,6 +638,12 @@ void Deck::shuffle(std::mt19937& re)
             ++i;
         }
     }
+    if(track_positions)
+    {
+        assert(variable_cards.empty() && upgrade_points == 0);
+        shuffled_positions.resize(cards.size());
+        std::iota(shuffled_positions.begin(), shuffled_positions.end(), 0);
+    }
     if(strategy != DeckStrategy::exact_ordered)
     {
         auto shufflable_iter = shuffled_cards.begin();
@@ -591,7 +656,20 @@ void Deck::shuffle(std::mt19937& re)
                 ++ shufflable_iter;
             }
         }
-        std::shuffle(shufflable_iter, shuffled_cards.end(), re);
+        if(track_positions)
+        {
+            // the same permutation as shuffling the cards, applied to their positions
+            assert(given_hand.empty());
+            std::shuffle(shuffled_positions.begin(), shuffled_positions.end(), re);
+            for(unsigned i = 0; i < cards.size(); ++i)
+            {
+                shuffled_cards[i] = cards[shuffled_positions[i]];
+            }
+        }
+        else
+        {
+            std::shuffle(shufflable_iter, shuffled_cards.end(), re);
+        }
 #if 0
         if(!given_hand.empty())
         {
@@ -610,15 +688,143 @@ void Deck::place_at_bottom(const Card* card)
     shuffled_cards.push_back(card);
 }
 
+void Deck::save(DrawState& state) const
+{
+    state.shuffled_commander = shuffled_commander;
+    state.shuffled_forts = shuffled_forts;
+    state.shuffled_cards = shuffled_cards;
+    state.shuffled_positions = shuffled_positions;
+    state.order = order;
+}
+
+void Deck::restore(const DrawState& state)
+{
+    shuffled_commander = state.shuffled_commander;
+    shuffled_forts = state.shuffled_forts;
+    shuffled_cards = state.shuffled_cards;
+    shuffled_positions = state.shuffled_positions;
+    order = state.order;
+}
+
+unsigned Deck::draw_reach() const
+{
+    assert(track_positions);
+    unsigned reach = 0;
+    unsigned num_drawable = std::min<unsigned>(strategy == DeckStrategy::ordered ? 3u : 1u, shuffled_cards.size());
+    for(unsigned i = 0; i < num_drawable; ++i)
+    {
+        reach = std::max(reach, shuffled_positions[i] + 1);
+        if(strategy == DeckStrategy::ordered)
+        {
+            // the ordered draw compares the first remaining positions of the card ids
+            const auto & card_order = order.find(shuffled_cards[i]->m_id)->second;
+            reach = std::max<unsigned>(reach, card_order.empty() ? cards.size() : card_order.front() + 1);
+        }
+    }
+    return(reach);
+}
+
+void Deck::replace_suffix(const std::vector<const Card*>& cards_, unsigned prefix)
+{
+    assert(track_positions && cards_.size() == cards.size());
+    cards = cards_;
+    for(unsigned i = 0; i < shuffled_cards.size(); ++i)
+    {
+        if(shuffled_positions[i] >= prefix)
+        {
+            shuffled_cards[i] = cards[shuffled_positions[i]];
+        }
+    }
+    if(strategy == DeckStrategy::ordered)
+    {
+        // positions from prefix on have not been drawn yet: rebuild them from the new cards
+        for(auto & card_order: order)
+        {
+            while(!card_order.second.empty() && card_order.second.back() >= prefix)
+            {
+                card_order.second.pop_back();
+            }
+        }
+        for(unsigned i = prefix; i < cards.size(); ++i)
+        {
+            order[cards[i]->m_id].push_back(i);
+        }
+    }
+}
+
 void Decks::add_deck(Deck* deck, const std::string& deck_name)
 {
     by_name[deck_name] = deck;
     by_name[simplify_name(deck_name)] = deck;
+    lazy_by_name.erase(deck_name);
+    lazy_by_name.erase(simplify_name(deck_name));
+}
+
+// builder must add the decks named deck_names to the Decks passed to it
+void Decks::add_lazy_deck(std::function<void(Decks&)> builder, const std::vector<std::string>& deck_names, DeckType::DeckType decktype, unsigned id)
+{
+    unsigned index = lazy_builders.size();
+    lazy_builders.emplace_back(builder);
+    for (const auto & deck_name: deck_names)
+    {
+        lazy_by_name[deck_name] = index;
+        lazy_by_name[simplify_name(deck_name)] = index;
+    }
+    lazy_by_type_id[{decktype, id}] = index;
+}
+
+// Build the lazy deck; it takes only the names and type/id that no later deck has taken over.
+void Decks::materialize(unsigned index)
+{
+    auto builder = std::move(lazy_builders[index]);
+    lazy_builders[index] = nullptr;
+    if (!builder)
+    { return; }
+    Decks built;
+    builder(built);
+    decks.splice(decks.end(), built.decks);
+    for (const auto & it: built.by_name)
+    {
+        auto lazy_it = lazy_by_name.find(it.first);
+        if (lazy_it != lazy_by_name.end() && lazy_it->second == index)
+        {
+            by_name[it.first] = it.second;
+            lazy_by_name.erase(lazy_it);
+        }
+    }
+    for (const auto & it: built.by_type_id)
+    {
+        auto lazy_it = lazy_by_type_id.find(it.first);
+        if (lazy_it != lazy_by_type_id.end() && lazy_it->second == index)
+        {
+            by_type_id[it.first] = it.second;
+            lazy_by_type_id.erase(lazy_it);
+        }
+    }
+}
+
+void Decks::materialize_all()
+{
+    for (unsigned index = 0; index < lazy_builders.size(); ++ index)
+    {
+        materialize(index);
+    }
+    lazy_builders.clear();
+    lazy_by_name.clear();
+    lazy_by_type_id.clear();
 }
 
 Deck* Decks::find_deck_by_name(const std::string& deck_name)
 {
-    auto it = by_name.find(simplify_name(deck_name));
+    auto simple_name = simplify_name(deck_name);
+    auto lazy_it = lazy_by_name.find(simple_name);
+    if (lazy_it != lazy_by_name.end())
+    {
+        materialize(lazy_it->second);
+        // still there if the deck failed to build
+        lazy_by_name.erase(simple_name);
+    }
+    auto it = by_name.find(simple_name);
     return it == by_name.end() ? nullptr : it->second;
 }
 
@@ -1,7 +1,9 @@
 #ifndef DECK_H_INCLUDED
 #define DECK_H_INCLUDED
 
+#include <cstdint>
 #include <deque>
+#include <functional>
 #include <list>
 #include <map>
 #include <random>
@@ -26,16 +28,54 @@ enum DeckStrategy
     num_deckstrategies
 };
 }
-typedef void (*DeckDecoder)(const char* hash, std::vector<unsigned>& ids);
-typedef void (*DeckEncoder)(std::stringstream &ios, const Card* commander, std::vector<const Card*> cards);
-void hash_to_ids_wmt_b64(const char* hash, std::vector<unsigned>& ids);
-void encode_deck_wmt_b64(std::stringstream &ios, const Card* commander, std::vector<const Card*> cards);
-void hash_to_ids_ext_b64(const char* hash, std::vector<unsigned>& ids);
-void encode_deck_ext_b64(std::stringstream &ios, const Card* commander, std::vector<const Card*> cards);
-void hash_to_ids_ddd_b64(const char* hash, std::vector<unsigned>& ids);
-void encode_deck_ddd_b64(std::stringstream &ios, const Card* commander, std::vector<const Card*> cards);
-extern DeckDecoder hash_to_ids;
-extern DeckEncoder encode_deck;
+
+//---------------------- Deck hashes: card ids encoded in base64 ---------------
+namespace DeckCodec
+{
+enum DeckCodec
+{
+    ext_b64,
+    wmt_b64,
+    ddd_b64,
+    num_deckcodecs
+};
+}
+extern std::string deckcodec_names[DeckCodec::num_deckcodecs];
+extern DeckCodec::DeckCodec deck_codec;  // the codec of the hashes read and printed, chosen at startup
+const size_t max_decoded_ids = 256;  // hash_to_ids decodes hashes of up to this many ids on the stack, longer ones on the heap
+
+// The most ids a hash of length characters can decode to in codec: one per character, except for the wmt_b64 repeat
+// counts, whose two characters stand for up to 94 more copies of the card before them.
+inline size_t max_ids_in_hash(DeckCodec::DeckCodec codec, size_t length) { return codec == DeckCodec::wmt_b64 ? length / 2 * 94 : length; }
+
+// Length of the buffer that holds the hash of num_ids ids in any codec, including the terminating '\0'.
+inline size_t max_hash_length(size_t num_ids) { return num_ids * 7 + 1; }
+// Writes the hash of ids into buffer and returns its length. Nothing is allocated.
+size_t encode_ids(DeckCodec::DeckCodec codec, char* buffer, const unsigned* ids, size_t num_ids);
+// Reads the ids of hash into ids and returns their number; throws if the hash is invalid or holds more than max_ids.
+size_t decode_hash(DeckCodec::DeckCodec codec, const char* hash, unsigned* ids, size_t max_ids);
+// Appends the ids of hash in deck_codec to ids.
+void hash_to_ids(const char* hash, std::vector<unsigned>& ids);
+
+//------------------------------------------------------------------------------
+// Set of card ids kept as a bitmap over the ids, so a lookup is a single load and bit test.
+class CardIdSet
+{
+public:
+    void insert(unsigned id)
+    {
+        if (id / 64 >= m_bits.size()) { m_bits.resize(id / 64 + 1, 0); }
+        m_bits[id / 64] |= uint64_t(1) << (id % 64);
+    }
+    unsigned count(unsigned id) const
+    {
+        return id / 64 < m_bits.size() ? (m_bits[id / 64] >> (id % 64)) & 1 : 0;
+    }
+    void clear() { m_bits.clear(); }
+
+private:
+    std::vector<uint64_t> m_bits;
+};
 
 //------------------------------------------------------------------------------
 // No support for ordered raid decks
@@ -58,6 +98,8 @@ public:
     const Card* shuffled_commander;
     std::deque<const Card*> shuffled_forts;
     std::deque<const Card*> shuffled_cards;
+    bool track_positions;  // keep shuffled_positions (forked evaluation, see replace_suffix)
+    std::deque<unsigned> shuffled_positions;  // position in cards of each of shuffled_cards
 
     // card id -> card order
     std::map<unsigned, std::list<unsigned>> order;
@@ -66,9 +108,9 @@ public:
     unsigned mission_req;
 
     std::string deck_string;
-    std::set<unsigned> vip_cards;
-    std::set<unsigned> allowed_candidates;
-    std::set<unsigned> disallowed_candidates;
+    CardIdSet vip_cards;
+    CardIdSet allowed_candidates;
+    CardIdSet disallowed_candidates;
     std::vector<unsigned> given_hand;
     std::vector<const Card*> fort_cards;
 
@@ -89,6 +131,7 @@ public:
         strategy(strategy_),
         commander(nullptr),
         shuffled_commander(nullptr),
+        track_positions(false),
         deck_size(0),
         mission_req(0)
     {
@@ -132,6 +175,7 @@ public:
 
     Deck* clone() const;
     std::string hash() const;
+    size_t hash(char* buffer) const;  // buffer holds max_hash_length(cards.size() + 1); returns the length
     std::string short_description() const;
     std::string medium_description() const;
     std::string long_description() const;
@@ -139,7 +183,26 @@ public:
     const Card* next();
     const Card* upgrade_card(const Card* card, unsigned card_max_level, std::mt19937& re, unsigned &remaining_upgrade_points, unsigned &remaining_upgrade_opportunities);
     void shuffle(std::mt19937& re);
+    // False if shuffle() draws nothing from re, so that every shuffle gives the same cards in the same order.
+    bool shuffle_draws() const { return(strategy != DeckStrategy::exact_ordered || !variable_cards.empty() || upgrade_points > 0); }
     void place_at_bottom(const Card* card);
+
+    // Draw state between turns: what shuffle() and next() change.
+    struct DrawState
+    {
+        const Card* shuffled_commander;
+        std::deque<const Card*> shuffled_forts;
+        std::deque<const Card*> shuffled_cards;
+        std::deque<unsigned> shuffled_positions;
+        std::map<unsigned, std::list<unsigned>> order;
+    };
+    void save(DrawState& state) const;
+    void restore(const DrawState& state);
+    // With track_positions: number of leading positions of cards the next draw depends on.
+    unsigned draw_reach() const;
+    // With track_positions: continue the draws with cards_, which equals cards before position prefix;
+    // valid while no draw so far has reached prefix.
+    void replace_suffix(const std::vector<const Card*>& cards_, unsigned prefix);
 };
 
 typedef std::map<std::string, long double> DeckList;
@@ -147,10 +210,19 @@ class Decks
 {
 public:
     void add_deck(Deck* deck, const std::string& deck_name);
+    void add_lazy_deck(std::function<void(Decks&)> builder, const std::vector<std::string>& deck_names, DeckType::DeckType decktype, unsigned id);
     Deck* find_deck_by_name(const std::string& deck_name);
+    void materialize_all();
     std::list<Deck> decks;
     std::map<std::pair<DeckType::DeckType, unsigned>, Deck*> by_type_id;
     std::map<std::string, Deck*> by_name;
+
+private:
+    // Decks indexed by name but not built yet; built into a scratch Decks on first lookup.
+    std::vector<std::function<void(Decks&)>> lazy_builders;
+    std::map<std::string, unsigned> lazy_by_name;  // -> index in lazy_builders
+    std::map<std::pair<DeckType::DeckType, unsigned>, unsigned> lazy_by_type_id;
+    void materialize(unsigned index);
 };
 
 #endif
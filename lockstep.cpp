@@ -0,0 +1,401 @@
+#include "lockstep.h"
+
+#include <algorithm>
+
+#include "card.h"
+#include "cards.h"
+#include "deck.h"
+
+//------------------------------------------------------------------------------
+bool lockstep_supports(const Card* card)
+{
+    for (const auto & ss: card->m_skills)
+    {
+        switch (ss.id)
+        {
+        case Skill::armor:
+        case Skill::counter:
+        case Skill::poison:
+            break;
+        case Skill::strike:
+        case Skill::heal:
+            if (ss.c > 0) { return false; }
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+namespace {
+// The lanes can play the hand: its cards are supported and fit, and none of them is a VIP card of player 0.
+bool lockstep_supports_hand(const Hand& hand, unsigned player)
+{
+    const Deck* deck = hand.deck;
+    auto supports = [deck, player](const Card* card) { return lockstep_supports(card) && !(player == 0 && deck->vip_cards.count(card->m_id)); };
+    return deck->shuffled_forts.size() + deck->shuffled_cards.size() <= lockstep_max_units
+        && lockstep_supports(deck->shuffled_commander)
+        && std::all_of(deck->shuffled_forts.begin(), deck->shuffled_forts.end(), supports)
+        && std::all_of(deck->shuffled_cards.begin(), deck->shuffled_cards.end(), supports);
+}
+}
+
+//------------------------------------------------------------------------------
+LockstepBattles::LockstepBattles(std::mt19937& re, const Cards& cards_, gamemode_t gamemode_, OptimizationMode optimization_mode_, const Quest& quest_, const ScoreTable& score_table_,
+        const BGEffects& bg_effects_, const std::vector<SkillSpec>& your_bg_skills_, const std::vector<SkillSpec>& enemy_bg_skills_, PlayFunction play_battle_) :
+    check(false),
+    num_lockstep_battles(0),
+    num_scalar_battles(0),
+    num_mismatches(0),
+    num_early_ends(0),
+    num_turns_saved(0),
+    cards(cards_),
+    gamemode(gamemode_),
+    optimization_mode(optimization_mode_),
+    quest(quest_),
+    score_table(score_table_),
+    bg_effects(bg_effects_),
+    your_bg_skills(your_bg_skills_),
+    enemy_bg_skills(enemy_bg_skills_),
+    play_battle(play_battle_),
+    sides(),
+    in_play(),
+    turn(0)
+{
+    for (auto & lane: lanes)
+    {
+        lane.re.seed(re());
+    }
+}
+
+void LockstepBattles::set_decks(const Deck* your_deck, const std::vector<Deck*>& enemy_decks)
+{
+    for (auto & lane: lanes)
+    {
+        lane.your_deck.reset(your_deck->clone());
+        if (!lane.your_hand) { lane.your_hand.reset(new Hand(nullptr)); }
+        lane.your_hand->deck = lane.your_deck.get();
+        lane.enemy_decks.resize(enemy_decks.size());
+        while (lane.enemy_hands.size() < enemy_decks.size()) { lane.enemy_hands.emplace_back(new Hand(nullptr)); }
+        for (unsigned i = 0; i < enemy_decks.size(); ++ i)
+        {
+            lane.enemy_decks[i].reset(enemy_decks[i]->clone());
+            lane.enemy_hands[i]->deck = lane.enemy_decks[i].get();
+        }
+    }
+}
+
+std::vector<std::vector<Results<uint64_t>>> LockstepBattles::evaluate(unsigned num_lanes)
+{
+    assert(num_lanes <= lockstep_width);
+    std::vector<std::vector<Results<uint64_t>>> res(num_lanes);
+    const unsigned num_enemy_decks = lanes[0].enemy_decks.size();
+    for (unsigned e = 0; e < num_enemy_decks; ++ e)
+    {
+        for (unsigned l = 0; l < num_lanes; ++ l)
+        {
+            start_lane(l, *lanes[l].enemy_hands[e]);
+        }
+        play_turns(num_lanes, e);
+        for (unsigned l = 0; l < num_lanes; ++ l)
+        {
+            res[l].push_back(lane_results[l]);
+        }
+    }
+    return res;
+}
+
+Results<uint64_t> LockstepBattles::play_scalar(Lane& lane, Hand& enemy_hand)
+{
+    Field fd(lane.re, cards, *lane.your_hand, enemy_hand, gamemode, optimization_mode, quest, score_table, bg_effects, your_bg_skills, enemy_bg_skills);
+    return play_battle(&fd);
+}
+
+// Shuffles the decks of lane l and plays its fortresses, or plays the whole battle with play() if the lanes cannot.
+void LockstepBattles::start_lane(unsigned l, Hand& enemy_hand)
+{
+    Lane & lane = lanes[l];
+    if (check)
+    {
+        lane.check_re = lane.re;
+        lane.check_card_pools[0] = lane.your_deck->variable_cards;
+        lane.check_card_pools[1] = enemy_hand.deck->variable_cards;
+    }
+    lane.your_hand->reset(lane.re);
+    enemy_hand.reset(lane.re);
+    if (!lockstep_supports_hand(*lane.your_hand, 0) || !lockstep_supports_hand(enemy_hand, 1))
+    {
+        Field fd(lane.re, cards, *lane.your_hand, enemy_hand, gamemode, optimization_mode, quest, score_table, bg_effects, your_bg_skills, enemy_bg_skills);
+        lane_results[l] = play_battle(&fd);
+        num_early_ends += fd.turns_saved > 0;
+        num_turns_saved += fd.turns_saved;
+        in_play[l] = false;
+        ++ num_scalar_battles;
+        return;
+    }
+    const std::array<const Hand*, 2> hands{{lane.your_hand.get(), &enemy_hand}};
+    for (unsigned i = 0; i < 2; ++ i)
+    {
+        Side & side = sides[i];
+        const Deck* deck = hands[i]->deck;
+        side.commander[l] = deck->shuffled_commander;
+        side.commander_hp[l] = deck->shuffled_commander->m_health;
+        side.num_assaults[l] = 0;
+        side.num_structures[l] = 0;
+        // no fortress acts when played, so the order of the players does not matter
+        for (const Card* card: deck->shuffled_forts)
+        {
+            unsigned index = side.num_structures[l] ++;
+            side.structure_card[index][l] = card;
+            side.structure_delay[index][l] = card->m_delay;
+        }
+    }
+    in_play[l] = true;
+    ++ num_lockstep_battles;
+}
+
+void LockstepBattles::play_turns(unsigned num_lanes, unsigned enemy_index)
+{
+    unsigned tapi = gamemode == surge ? 1 : 0;
+    for (turn = 1; std::any_of(in_play.begin(), in_play.begin() + num_lanes, [](bool b) { return b; }); )
+    {
+        Side & tap = sides[tapi];
+        Side & tip = sides[1 - tapi];
+        unsigned max_assaults = 0, max_structures = 0;
+        for (unsigned l = 0; l < num_lanes; ++ l)
+        {
+            max_assaults = std::max(max_assaults, tap.num_assaults[l]);
+            max_structures = std::max(max_structures, tap.num_structures[l]);
+        }
+        // Timers of the active player's units; a lane past its end or its units is left as it is
+        for (unsigned index = 0; index < max_assaults; ++ index)
+        {
+            for (unsigned l = 0; l < lockstep_width; ++ l)
+            {
+                tap.delay[index][l] -= (index < tap.num_assaults[l]) & (tap.delay[index][l] > 0);
+            }
+        }
+        for (unsigned index = 0; index < max_structures; ++ index)
+        {
+            for (unsigned l = 0; l < lockstep_width; ++ l)
+            {
+                tap.structure_delay[index][l] -= (index < tap.num_structures[l]) & (tap.structure_delay[index][l] > 0);
+            }
+        }
+        // Play a card
+        for (unsigned l = 0; l < num_lanes; ++ l)
+        {
+            if (!in_play[l]) { continue; }
+            Hand & hand = tapi == 0 ? *lanes[l].your_hand : *lanes[l].enemy_hands[enemy_index];
+            const Card* card = hand.deck->next();
+            if (card == nullptr) { continue; }
+            if (card->m_type == CardType::assault)
+            {
+                unsigned index = tap.num_assaults[l] ++;
+                max_assaults = std::max(max_assaults, index + 1);
+                tap.card[index][l] = card;
+                tap.delay[index][l] = card->m_delay;
+                tap.attack[index][l] = card->m_attack;
+                tap.hp[index][l] = tap.max_hp[index][l] = card->m_health;
+                tap.poisoned[index][l] = 0;
+            }
+            else
+            {
+                unsigned index = tap.num_structures[l] ++;
+                max_structures = std::max(max_structures, index + 1);
+                tap.structure_card[index][l] = card;
+                tap.structure_delay[index][l] = card->m_delay;
+            }
+        }
+        // Commander, structures, then assaults, each unit of all the lanes before the next
+        for (unsigned l = 0; l < num_lanes; ++ l)
+        {
+            if (in_play[l]) { perform_skills(l, tapi, tap.commander[l]); }
+        }
+        for (unsigned index = 0; index < max_structures; ++ index)
+        {
+            for (unsigned l = 0; l < num_lanes; ++ l)
+            {
+                if (in_play[l] && index < tap.num_structures[l] && tap.structure_delay[index][l] == 0)
+                {
+                    perform_skills(l, tapi, tap.structure_card[index][l]);
+                }
+            }
+        }
+        for (unsigned index = 0; index < max_assaults; ++ index)
+        {
+            for (unsigned l = 0; l < num_lanes; ++ l)
+            {
+                if (in_play[l] && tip.commander_hp[l] > 0 && index < tap.num_assaults[l] && tap.hp[index][l] > 0 && tap.delay[index][l] == 0)
+                {
+                    perform_skills(l, tapi, tap.card[index][l]);
+                    attack(l, tapi, index);
+                }
+            }
+        }
+        // Poison on the active player's assaults
+        for (unsigned index = 0; index < max_assaults; ++ index)
+        {
+            for (unsigned l = 0; l < lockstep_width; ++ l)
+            {
+                unsigned hp = tap.hp[index][l];
+                unsigned poison_dmg = (index < tap.num_assaults[l]) & (hp > 0) ? std::min(hp, tap.poisoned[index][l]) : 0;
+                tap.hp[index][l] = hp - poison_dmg;
+            }
+        }
+        // Remove the dead
+        for (unsigned l = 0; l < num_lanes; ++ l)
+        {
+            if (!in_play[l]) { continue; }
+            for (Side * side: {&tap, &tip})
+            {
+                unsigned head = 0;
+                for (unsigned index = 0; index < side->num_assaults[l]; ++ index)
+                {
+                    if (side->hp[index][l] == 0) { continue; }
+                    if (index != head)
+                    {
+                        side->card[head][l] = side->card[index][l];
+                        side->delay[head][l] = side->delay[index][l];
+                        side->attack[head][l] = side->attack[index][l];
+                        side->hp[head][l] = side->hp[index][l];
+                        side->max_hp[head][l] = side->max_hp[index][l];
+                        side->poisoned[head][l] = side->poisoned[index][l];
+                    }
+                    ++ head;
+                }
+                side->num_assaults[l] = head;
+            }
+        }
+        // as in play(), the turn of a win ends with its poison and the removal of the dead
+        for (unsigned l = 0; l < num_lanes; ++ l)
+        {
+            if (in_play[l] && tip.commander_hp[l] == 0) { end_lane(l, enemy_index, turn); }
+        }
+        tapi = 1 - tapi;
+        ++ turn;
+        for (unsigned l = 0; l < num_lanes; ++ l)
+        {
+            if (!in_play[l]) { continue; }
+            if (turn > turn_limit)
+            {
+                end_lane(l, enemy_index, turn);
+            }
+            // as outcome_decided(): no assault left to attack, and none of the skills of the lanes hits structures
+            else if (tap.num_assaults[l] == 0 && tip.num_assaults[l] == 0 && lanes[l].your_hand->deck->shuffled_cards.empty()
+                && lanes[l].enemy_hands[enemy_index]->deck->shuffled_cards.empty())
+            {
+                ++ num_early_ends;
+                num_turns_saved += turn_limit + 1 - turn;
+                end_lane(l, enemy_index, turn_limit + 1);
+            }
+        }
+    }
+}
+
+// The activation skills of card, a unit of player tapi in lane l, chosen and applied as play() does.
+void LockstepBattles::perform_skills(unsigned l, unsigned tapi, const Card* card)
+{
+    std::mt19937 & re = lanes[l].re;
+    for (const auto & ss: card->m_activation_skills)
+    {
+        const bool is_strike = ss.id == Skill::strike;
+        Side & side = sides[is_strike ? 1 - tapi : tapi];
+        unsigned targets[lockstep_max_units];
+        unsigned n_candidates = 0;
+        for (unsigned index = 0; index < side.num_assaults[l]; ++ index)
+        {
+            unsigned hp = side.hp[index][l];
+            Faction faction = side.card[index][l]->m_faction;
+            if (hp > 0 && (is_strike || hp < side.max_hp[index][l]) && (ss.y == allfactions || faction == ss.y || faction == progenitor))
+            {
+                targets[n_candidates ++] = index;
+            }
+        }
+        if (n_candidates == 0) { continue; }
+        unsigned n_targets = ss.n > 0 ? ss.n : 1;
+        if (ss.all || n_targets >= n_candidates)
+        {
+            n_targets = n_candidates;
+        }
+        else
+        {
+            // play() also sorts the targets, which does not matter to strike and heal
+            for (unsigned i = 0; i < n_targets; ++ i)
+            {
+                std::swap(targets[i], targets[std::uniform_int_distribution<unsigned>(i, n_candidates - 1)(re)]);
+            }
+        }
+        for (unsigned i = 0; i < n_targets; ++ i)
+        {
+            unsigned & hp = side.hp[targets[i]][l];
+            hp = is_strike ? safe_minus(hp, ss.x) : std::min(hp + ss.x, side.max_hp[targets[i]][l]);
+        }
+    }
+}
+
+// The attack of the assault at index of player tapi in lane l: against the assault across if it is alive,
+// otherwise against the commander, reduced by armor, then poison and counter if it deals damage.
+void LockstepBattles::attack(unsigned l, unsigned tapi, unsigned index)
+{
+    Side & att = sides[tapi];
+    Side & def = sides[1 - tapi];
+    const Card* att_card = att.card[index][l];
+    if (att.attack[index][l] == 0) { return; }
+    const Card* def_card;
+    if (index < def.num_assaults[l] && def.hp[index][l] > 0)
+    {
+        def_card = def.card[index][l];
+        unsigned att_dmg = safe_minus(att.attack[index][l], def_card->m_skill_value[Skill::armor]);
+        if (att_dmg == 0) { return; }
+        def.hp[index][l] = safe_minus(def.hp[index][l], att_dmg);
+        def.poisoned[index][l] = std::max(def.poisoned[index][l], att_card->m_skill_value[Skill::poison]);
+    }
+    else
+    {
+        def_card = def.commander[l];
+        unsigned att_dmg = safe_minus(att.attack[index][l], def_card->m_skill_value[Skill::armor]);
+        if (att_dmg == 0) { return; }
+        def.commander_hp[l] = safe_minus(def.commander_hp[l], att_dmg);
+        if (def.commander_hp[l] == 0) { return; }
+    }
+    att.hp[index][l] = safe_minus(att.hp[index][l], def_card->m_skill_value[Skill::counter]);
+}
+
+// Scores the battle of lane l, over as it is at end_turn, and replays it with play() if check.
+void LockstepBattles::end_lane(unsigned l, unsigned enemy_index, unsigned end_turn)
+{
+    Lane & lane = lanes[l];
+    Hand & enemy_hand = *lane.enemy_hands[enemy_index];
+    const std::array<const Deck*, 2> decks{{lane.your_hand->deck, enemy_hand.deck}};
+    BattleOutcome outcome;
+    outcome.turn = end_turn;
+    for (unsigned i = 0; i < 2; ++ i)
+    {
+        outcome.commander_hp[i] = sides[i].commander_hp[l];
+        outcome.commander_max_hp[i] = sides[i].commander[l]->m_health;
+        outcome.num_units[i] = sides[i].num_assaults[l] + sides[i].num_structures[l];
+        outcome.num_cards_left[i] = decks[i]->shuffled_cards.size();
+    }
+    outcome.your_deck_size = decks[0]->cards.size();
+    outcome.enemy_deck_size = decks[1]->deck_size;
+    lane_results[l] = score_table.score(outcome, 0);
+    in_play[l] = false;
+    if (check)
+    {
+        std::mt19937 lane_re = lane.re;
+        lane.re = lane.check_re;
+        lane.your_deck->variable_cards = lane.check_card_pools[0];
+        enemy_hand.deck->variable_cards = lane.check_card_pools[1];
+        lane.your_hand->reset(lane.re);
+        enemy_hand.reset(lane.re);
+        const Results<uint64_t> & res = lane_results[l];
+        Results<uint64_t> scalar_res = play_scalar(lane, enemy_hand);
+        if (scalar_res.wins != res.wins || scalar_res.draws != res.draws || scalar_res.losses != res.losses || scalar_res.points != res.points || !(lane.re == lane_re))
+        {
+            ++ num_mismatches;
+        }
+        lane.re = lane_re;
+    }
+}
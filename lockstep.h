@@ -0,0 +1,96 @@
+#ifndef LOCKSTEP_H_INCLUDED
+#define LOCKSTEP_H_INCLUDED
+
+#include <array>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "sim.h"
+
+//---------------------- Lockstep battles --------------------------------------
+// Plays lockstep_width battles ("lanes") at once, turn by turn, with the state of the units laid out
+// as [unit][lane] so that each pass over the units runs over the lanes side by side.
+// Only battles between cards whose skills are strike and heal (without cooldown), armor, counter and poison
+// are played in lanes, and only without BGEs or quests; any other battle is played by play().
+// A battle in a lane consumes the random engine of its lane exactly as play() would.
+//------------------------------------------------------------------------------
+const unsigned lockstep_width = 8;
+const unsigned lockstep_max_units = 32;  // assaults or structures of one side
+
+// True if the lanes can play card.
+bool lockstep_supports(const Card* card);
+
+class LockstepBattles
+{
+public:
+    LockstepBattles(std::mt19937& re, const Cards& cards_, gamemode_t gamemode_, OptimizationMode optimization_mode_, const Quest& quest_, const ScoreTable& score_table_,
+            const BGEffects& bg_effects_, const std::vector<SkillSpec>& your_bg_skills_, const std::vector<SkillSpec>& enemy_bg_skills_, PlayFunction play_battle_);
+
+    void set_decks(const Deck* your_deck, const std::vector<Deck*>& enemy_decks);
+    // Plays num_lanes iterations, at most lockstep_width, each with one battle against every enemy deck:
+    // returns the results of each iteration, as SimulationData::evaluate() does.
+    std::vector<std::vector<Results<uint64_t>>> evaluate(unsigned num_lanes);
+
+    // check: replay every battle played in a lane by play() and count those that end differently.
+    bool check;
+    unsigned long long num_lockstep_battles;
+    unsigned long long num_scalar_battles;
+    unsigned long long num_mismatches;
+    // battles ended early as play() ends them (see outcome_decided()), and the turns they saved
+    unsigned long long num_early_ends;
+    unsigned long long num_turns_saved;
+
+private:
+    struct Lane
+    {
+        std::mt19937 re;
+        std::shared_ptr<Deck> your_deck;
+        std::vector<std::shared_ptr<Deck>> enemy_decks;
+        std::unique_ptr<Hand> your_hand;
+        std::vector<std::unique_ptr<Hand>> enemy_hands;
+        // with check: the random engine and the card pools (which shuffle() permutes) at the start of the battle
+        std::mt19937 check_re;
+        std::array<decltype(Deck::variable_cards), 2> check_card_pools;
+    };
+    // The units of one player in every lane.
+    struct Side
+    {
+        std::array<const Card*, lockstep_width> commander;
+        std::array<unsigned, lockstep_width> commander_hp;
+        std::array<unsigned, lockstep_width> num_assaults;
+        std::array<unsigned, lockstep_width> num_structures;
+        const Card* card[lockstep_max_units][lockstep_width];
+        unsigned delay[lockstep_max_units][lockstep_width];
+        unsigned attack[lockstep_max_units][lockstep_width];
+        unsigned hp[lockstep_max_units][lockstep_width];
+        unsigned max_hp[lockstep_max_units][lockstep_width];
+        unsigned poisoned[lockstep_max_units][lockstep_width];
+        const Card* structure_card[lockstep_max_units][lockstep_width];
+        unsigned structure_delay[lockstep_max_units][lockstep_width];
+    };
+
+    const Cards& cards;
+    gamemode_t gamemode;
+    OptimizationMode optimization_mode;
+    const Quest& quest;
+    const ScoreTable& score_table;
+    const BGEffects& bg_effects;
+    const std::vector<SkillSpec>& your_bg_skills;
+    const std::vector<SkillSpec>& enemy_bg_skills;
+    PlayFunction play_battle;
+    std::array<Lane, lockstep_width> lanes;
+    std::array<Side, 2> sides;
+    std::array<bool, lockstep_width> in_play;  // the lane plays a battle that is not over
+    std::array<Results<uint64_t>, lockstep_width> lane_results;
+    unsigned turn;
+
+    Results<uint64_t> play_scalar(Lane& lane, Hand& enemy_hand);
+    void start_lane(unsigned l, Hand& enemy_hand);
+    void play_turns(unsigned num_lanes, unsigned enemy_index);
+    void perform_skills(unsigned l, unsigned tapi, const Card* card);
+    void attack(unsigned l, unsigned tapi, unsigned index);
+    void end_lane(unsigned l, unsigned enemy_index, unsigned end_turn);
+};
+
+#endif
@@ -74,6 +74,22 @@ template<typename Iterator, typename Functor, typename Token> Iterator read_toke
     return(token_end_after_spaces);
 }
 
+// split on any of the delimiters, skipping empty tokens as boost::char_delimiters_separator does, without copying
+std::vector<boost::string_ref> split_tokens(boost::string_ref s, const char * delimiters)
+{
+    std::vector<boost::string_ref> tokens;
+    auto is_delimiter = [delimiters](char c){return(c != '\0' && strchr(delimiters, c));};
+    auto it = s.begin();
+    while(true)
+    {
+        auto token_start = advance_until(it, s.end(), [&](char c){return(!is_delimiter(c));});
+        if(token_start == s.end()) { break; }
+        it = advance_until(token_start, s.end(), is_delimiter);
+        tokens.emplace_back(token_start, static_cast<size_t>(it - token_start));
+    }
+    return(tokens);
+}
+
 DeckList & normalize(DeckList & decklist)
 {
     long double factor_sum = 0;
@@ -122,6 +138,7 @@ DeckList expand_deck_to_list(std::string deck_name, Decks& decks)
         boost::regex regex(regex_string);
         boost::smatch smatch;
         expanding_decks.insert(deck_name);
+        decks.materialize_all();
         for (const auto & deck_it: decks.by_name)
         {
             if (boost::regex_search(deck_it.first, smatch, regex))
@@ -178,7 +195,7 @@ DeckList parse_deck_list(std::string list_string, Decks& decks)
     return res;
 }
 
-void parse_card_spec(const Cards& all_cards, const std::string& card_spec, unsigned& card_id, unsigned& card_num, char& num_sign, char& mark)
+void parse_card_spec(const Cards& all_cards, boost::string_ref card_spec, unsigned& card_id, unsigned& card_num, char& num_sign, char& mark)
 {
 //    static std::set<std::string> recognized_abbr;
     auto card_spec_iter = card_spec.begin();
@@ -186,39 +203,61 @@ void parse_card_spec(const Cards& all_cards, const std::string& card_spec, unsig
     card_num = 1;
     num_sign = 0;
     mark = 0;
-    std::string card_name;
-    card_spec_iter = read_token(card_spec_iter, card_spec.end(), [](char c){return(c=='#' || c=='(' || c=='\r');}, card_name);
-    if(card_name[0] == '!')
-    {
-        mark = card_name[0];
-        card_name.erase(0, 1);
-    }
-    // If card name is not found, try find card id quoted in '[]' in name, ignoring other characters.
-    std::string simple_name{simplify_name(card_name)};
-    const auto && abbr_it = all_cards.player_cards_abbr.find(simple_name);
-    if(abbr_it != all_cards.player_cards_abbr.end())
-    {
-//        if(recognized_abbr.count(card_name) == 0)
-//        {
-//            std::cout << "Recognize abbreviation " << card_name << ": " << abbr_it->second << std::endl;
-//            recognized_abbr.insert(card_name);
-//        }
-        simple_name = simplify_name(abbr_it->second);
-    }
-    auto card_it = all_cards.cards_by_name.find(simple_name);
-    auto card_id_iter = advance_until(simple_name.begin(), simple_name.end(), [](char c){return(c=='[');});
-    if (card_it != all_cards.cards_by_name.end())
-    {
-        card_id = card_it->second->m_id;
-        if (all_cards.ambiguous_names.count(simple_name))
+    auto is_name_end = [](char c){return(c=='#' || c=='(' || c=='\r');};
+    card_spec_iter = advance_until(card_spec_iter, card_spec.end(), is_name_end);
+    boost::string_ref raw_name{card_spec.begin(), static_cast<size_t>(card_spec_iter - card_spec.begin())};
+    auto raw_name_iter = advance_until(raw_name.begin(), raw_name.end(), [](char c){return(c != ' ');});
+    if(raw_name_iter != raw_name.end() && *raw_name_iter == '!')
+    {
+        mark = *raw_name_iter;
+    }
+    // The card name is only copied out of card_spec to report a problem or for the slow path.
+    auto get_card_name = [&]()
+    {
+        std::string card_name;
+        read_token(raw_name.begin(), raw_name.end(), is_name_end, card_name);
+        if(mark) { card_name.erase(0, 1); }
+        return(card_name);
+    };
+    const auto * name_entry = all_cards.name_index.find(raw_name);
+    if(name_entry != nullptr)
+    {
+        card_id = name_entry->card->m_id;
+        if (name_entry->ambiguous)
         {
-            std::cerr << "Warning: There are multiple cards named " << card_name << " in cards.xml. [" << card_id << "] is used.\n";
+            std::cerr << "Warning: There are multiple cards named " << get_card_name() << " in cards.xml. [" << card_id << "] is used.\n";
         }
     }
-    else if(card_id_iter != simple_name.end())
+    else
     {
-        ++ card_id_iter;
-        card_id_iter = read_token(card_id_iter, simple_name.end(), [](char c){return(c==']');}, card_id);
+        std::string card_name{get_card_name()};
+        // If card name is not found, try find card id quoted in '[]' in name, ignoring other characters.
+        std::string simple_name{simplify_name(card_name)};
+        const auto && abbr_it = all_cards.player_cards_abbr.find(simple_name);
+        if(abbr_it != all_cards.player_cards_abbr.end())
+        {
+//            if(recognized_abbr.count(card_name) == 0)
+//            {
+//                std::cout << "Recognize abbreviation " << card_name << ": " << abbr_it->second << std::endl;
+//                recognized_abbr.insert(card_name);
+//            }
+            simple_name = simplify_name(abbr_it->second);
+        }
+        auto card_it = all_cards.cards_by_name.find(simple_name);
+        auto card_id_iter = advance_until(simple_name.begin(), simple_name.end(), [](char c){return(c=='[');});
+        if (card_it != all_cards.cards_by_name.end())
+        {
+            card_id = card_it->second->m_id;
+            if (all_cards.ambiguous_names.count(simple_name))
+            {
+                std::cerr << "Warning: There are multiple cards named " << card_name << " in cards.xml. [" << card_id << "] is used.\n";
+            }
+        }
+        else if(card_id_iter != simple_name.end())
+        {
+            ++ card_id_iter;
+            card_id_iter = read_token(card_id_iter, simple_name.end(), [](char c){return(c==']');}, card_id);
+        }
     }
     if(card_spec_iter != card_spec.end() && (*card_spec_iter == '#' || *card_spec_iter == '('))
     {
@@ -235,7 +274,7 @@ void parse_card_spec(const Cards& all_cards, const std::string& card_spec, unsig
     }
     if(card_id == 0)
     {
-        throw std::runtime_error("Unknown card: " + card_name);
+        throw std::runtime_error("Unknown card: " + get_card_name());
     }
 }
 
@@ -244,12 +283,9 @@ const std::pair<std::vector<unsigned>, std::map<signed, char>> string_to_ids(con
     std::vector<unsigned> card_ids;
     std::map<signed, char> card_marks;
     std::vector<std::string> error_list;
-    boost::tokenizer<boost::char_delimiters_separator<char>> deck_tokens{deck_string, boost::char_delimiters_separator<char>{false, ":,", ""}};
-    auto token_iter = deck_tokens.begin();
     signed p = -1;
-    for(; token_iter != deck_tokens.end(); ++token_iter)
+    for(const auto & card_spec: split_tokens(deck_string, ":,"))
     {
-        std::string card_spec(*token_iter);
         unsigned card_id{0};
         unsigned card_num{1};
         char num_sign{0};
@@ -429,7 +465,7 @@ unsigned load_custom_decks(Decks& decks, Cards& all_cards, const std::string & f
     return(0);
 }
 
-void add_owned_card(Cards& all_cards, std::map<unsigned, unsigned>& owned_cards, std::string& card_spec)
+void add_owned_card(Cards& all_cards, std::map<unsigned, unsigned>& owned_cards, boost::string_ref card_spec)
 {
     unsigned card_id{0};
     unsigned card_num{1};
@@ -460,19 +496,15 @@ void read_owned_cards(Cards& all_cards, std::map<unsigned, unsigned>& owned_card
         // try parse the string as a cards instead of as a filename
         try
         {
-            std::string card_list(filename);
-            boost::tokenizer<boost::char_delimiters_separator<char>> card_tokens{card_list, boost::char_delimiters_separator<char>{false, ",", ""}};
-            auto token_iter = card_tokens.begin();
-            for (; token_iter != card_tokens.end(); ++token_iter)
+            for (const auto & card_spec: split_tokens(filename, ","))
             {
-                std::string card_spec(*token_iter);
                 add_owned_card(all_cards, owned_cards, card_spec);
             }
         } 
         catch (std::exception& e)
         {
             std::cerr << "Error: Failed to parse owned cards: '" << filename << "' is neither a file nor a valid set of cards (" << e.what() << ")" << std::endl;
-            exit(0);
+            throw;
         }
         return;
     }
@@ -2,6 +2,7 @@
 
 #include <boost/range/adaptors.hpp>
 #include <boost/range/join.hpp>
+#include <functional>
 #include <iostream>
 #include <random>
 #include <string>
@@ -97,9 +98,10 @@ inline void Field::print_selection_array()
 #endif
 }
 //------------------------------------------------------------------------------
+// The offset and enhance arrays are all zero unless m_skill_modified, so most lookups read m_card only.
 inline unsigned CardStatus::skill_base_value(Skill::Skill skill_id) const
 {
-    return m_card->m_skill_value[skill_id + m_primary_skill_offset[skill_id]]
+    return m_card->m_skill_value[skill_id + (m_skill_modified ? m_primary_skill_offset[skill_id] : 0)]
             + (skill_id == Skill::berserk ? m_enraged : 0);
 }
 //------------------------------------------------------------------------------
@@ -115,7 +117,7 @@ inline bool CardStatus::has_skill(Skill::Skill skill_id) const
 //------------------------------------------------------------------------------
 inline unsigned CardStatus::enhanced(Skill::Skill skill_id) const
 {
-    return m_enhanced_value[skill_id + m_primary_skill_offset[skill_id]];
+    return m_skill_modified ? m_enhanced_value[skill_id + m_primary_skill_offset[skill_id]] : 0;
 }
 //------------------------------------------------------------------------------
 inline unsigned CardStatus::protected_value() const
@@ -160,6 +162,8 @@ inline void CardStatus::set(const Card& card)
     std::memset(m_evolved_skill_offset, 0, sizeof m_evolved_skill_offset);
     std::memset(m_enhanced_value, 0, sizeof m_enhanced_value);
     std::memset(m_skill_cd, 0, sizeof m_skill_cd);
+    m_skill_modified = false;
+    m_has_cooldown = false;
 }
 //------------------------------------------------------------------------------
 inline unsigned attack_power(const CardStatus* att)
@@ -276,6 +280,57 @@ void Hand::reset(std::mt19937& re)
     deck->shuffle(re);
     commander.set(deck->shuffled_commander);
 }
+
+void Hand::save(Snapshot& snapshot) const
+{
+    snapshot.commander = commander;
+    snapshot.assaults.clear();
+    for (const CardStatus * status: assaults.m_indirect) { snapshot.assaults.push_back(*status); }
+    snapshot.structures.clear();
+    for (const CardStatus * status: structures.m_indirect) { snapshot.structures.push_back(*status); }
+    deck->save(snapshot.deck);
+}
+
+void Hand::restore(const Snapshot& snapshot)
+{
+    commander = snapshot.commander;
+    assaults.reset();
+    for (const CardStatus & status: snapshot.assaults) { assaults.add_back() = status; }
+    structures.reset();
+    for (const CardStatus & status: snapshot.structures) { structures.add_back() = status; }
+    deck->restore(snapshot.deck);
+}
+//------------------------------------------------------------------------------
+void Field::save(Snapshot& snapshot) const
+{
+    assert(skill_queue.empty() && killed_units.empty());
+    snapshot.re = re;
+    snapshot.end = end;
+    snapshot.tapi = tapi;
+    snapshot.turn = turn;
+    snapshot.assault_bloodlusted = assault_bloodlusted;
+    snapshot.bloodlust_value = bloodlust_value;
+    snapshot.quest_counter = quest_counter;
+    snapshot.num_draws = num_draws;
+    for (unsigned i = 0; i < 2; ++ i) { players[i]->save(snapshot.players[i]); }
+}
+
+void Field::restore(const Snapshot& snapshot)
+{
+    re = snapshot.re;
+    end = snapshot.end;
+    tapi = snapshot.tapi;
+    tipi = (tapi + 1) % 2;
+    tap = players[tapi];
+    tip = players[tipi];
+    turn = snapshot.turn;
+    turns_saved = 0;
+    assault_bloodlusted = snapshot.assault_bloodlusted;
+    bloodlust_value = snapshot.bloodlust_value;
+    quest_counter = snapshot.quest_counter;
+    num_draws = snapshot.num_draws;
+    for (unsigned i = 0; i < 2; ++ i) { players[i]->restore(snapshot.players[i]); }
+}
 //---------------------- $40 Game rules implementation -------------------------
 // Everything about how a battle plays out, except the following:
 // the implementation of the attack by an assault card is in the next section;
@@ -382,7 +437,35 @@ void prepend_on_death(Field* fd)
     fd->killed_units.clear();
 }
 //------------------------------------------------------------------------------
-void(*skill_table[Skill::num_skills])(Field*, CardStatus* src, const SkillSpec&);
+template<Skill::Skill skill_id>
+void perform_targetted_allied_fast(Field* fd, CardStatus* src, const SkillSpec& s);
+void perform_targetted_allied_fast_rush(Field* fd, CardStatus* src, const SkillSpec& s);
+template<Skill::Skill skill_id>
+void perform_targetted_hostile_fast(Field* fd, CardStatus* src, const SkillSpec& s);
+// Switch over the activation skills (see is_activation_skill) rather than call through a table, so each case can be inlined.
+inline void perform_activation_skill(Field* fd, CardStatus* src, const SkillSpec& s)
+{
+    switch(s.id)
+    {
+    case Skill::enfeeble: perform_targetted_hostile_fast<Skill::enfeeble>(fd, src, s); break;
+    case Skill::enhance: perform_targetted_allied_fast<Skill::enhance>(fd, src, s); break;
+    case Skill::enrage: perform_targetted_allied_fast<Skill::enrage>(fd, src, s); break;
+    case Skill::evolve: perform_targetted_allied_fast<Skill::evolve>(fd, src, s); break;
+    case Skill::heal: perform_targetted_allied_fast<Skill::heal>(fd, src, s); break;
+    case Skill::jam: perform_targetted_hostile_fast<Skill::jam>(fd, src, s); break;
+    case Skill::mend: perform_targetted_allied_fast<Skill::mend>(fd, src, s); break;
+    case Skill::mortar: perform_targetted_hostile_fast<Skill::mortar>(fd, src, s); break;
+    case Skill::overload: perform_targetted_allied_fast<Skill::overload>(fd, src, s); break;
+    case Skill::protect: perform_targetted_allied_fast<Skill::protect>(fd, src, s); break;
+    case Skill::rally: perform_targetted_allied_fast<Skill::rally>(fd, src, s); break;
+    case Skill::rush: perform_targetted_allied_fast_rush(fd, src, s); break;
+    case Skill::siege: perform_targetted_hostile_fast<Skill::siege>(fd, src, s); break;
+    case Skill::strike: perform_targetted_hostile_fast<Skill::strike>(fd, src, s); break;
+    case Skill::sunder: perform_targetted_hostile_fast<Skill::sunder>(fd, src, s); break;
+    case Skill::weaken: perform_targetted_hostile_fast<Skill::weaken>(fd, src, s); break;
+    default: assert(false); break;
+    }
+}
 void resolve_skill(Field* fd)
 {
     while(!fd->skill_queue.empty())
@@ -406,7 +489,7 @@ void resolve_skill(Field* fd)
         unsigned enhanced_value = status->enhanced(evolved_s.id);
         auto& enhanced_s = enhanced_value > 0 ? apply_enhance(evolved_s, enhanced_value) : evolved_s;
         auto& modified_s = enhanced_s;
-        skill_table[modified_s.id](fd, status, modified_s);
+        perform_activation_skill(fd, status, modified_s);
     }
 }
 //------------------------------------------------------------------------------
@@ -415,20 +498,16 @@ template<Skill::Skill skill_id>
 bool check_and_perform_skill(Field* fd, CardStatus* src, CardStatus* dst, const SkillSpec& s, bool is_evadable, bool & has_counted_quest);
 bool check_and_perform_valor(Field* fd, CardStatus* src);
 template <enum CardType::CardType type>
-void evaluate_skills(Field* fd, CardStatus* status, const std::vector<SkillSpec>& skills, bool* attacked=nullptr)
+void evaluate_skills(Field* fd, CardStatus* status, bool* attacked=nullptr)
 {
     assert(status);
     unsigned num_actions(1);
     for (unsigned action_index(0); action_index < num_actions; ++ action_index)
     {
         assert(fd->skill_queue.size() == 0);
-        for (auto & ss: skills)
+        // activation skills only, assuming activation skills can be evolved from only activation skills
+        for (auto & ss: status->m_card->m_activation_skills)
         {
-            // check if activation skill, assuming activation skills can be evolved from only activation skills
-            if (skill_table[ss.id] == nullptr)
-            {
-                continue;
-            }
             if (status->m_skill_cd[ss.id] > 0)
             {
                 continue;
@@ -463,12 +542,13 @@ void evaluate_skills(Field* fd, CardStatus* status, const std::vector<SkillSpec>
             }
             _DEBUG_MSG(1, "%s activates Flurry x %d\n", status_description(status).c_str(), status->skill_base_value(Skill::flurry));
             num_actions += status->skill_base_value(Skill::flurry);
-            for (const auto & ss : skills)
+            for (const auto & ss : status->m_card->m_skills)
             {
                 Skill::Skill evolved_skill_id = static_cast<Skill::Skill>(ss.id + status->m_evolved_skill_offset[ss.id]);
                 if (evolved_skill_id == Skill::flurry)
                 {
                     status->m_skill_cd[ss.id] = ss.c;
+                    status->m_has_cooldown = true;
                 }
             }
         }
@@ -625,12 +705,18 @@ inline void add_hp(Field* fd, CardStatus* target, unsigned v)
 }
 void cooldown_skills(CardStatus * status)
 {
+    if (!status->m_has_cooldown)
+    {
+        return;
+    }
+    status->m_has_cooldown = false;
     for (const auto & ss : status->m_card->m_skills)
     {
         if (status->m_skill_cd[ss.id] > 0)
         {
             _DEBUG_MSG(2, "%s reduces timer (%u) of skill %s\n", status_description(status).c_str(), status->m_skill_cd[ss.id], skill_names[ss.id].c_str());
             -- status->m_skill_cd[ss.id];
+            status->m_has_cooldown |= status->m_skill_cd[ss.id] > 0;
         }
     }
 }
@@ -727,9 +813,13 @@ void turn_end_phase(Field* fd)
             }
             status.m_enfeebled = 0;
             status.m_protected = 0;
-            std::memset(status.m_primary_skill_offset, 0, sizeof status.m_primary_skill_offset);
-            std::memset(status.m_evolved_skill_offset, 0, sizeof status.m_evolved_skill_offset);
-            std::memset(status.m_enhanced_value, 0, sizeof status.m_enhanced_value);
+            if (status.m_skill_modified)
+            {
+                std::memset(status.m_primary_skill_offset, 0, sizeof status.m_primary_skill_offset);
+                std::memset(status.m_evolved_skill_offset, 0, sizeof status.m_evolved_skill_offset);
+                std::memset(status.m_enhanced_value, 0, sizeof status.m_enhanced_value);
+                status.m_skill_modified = false;
+            }
             status.m_evaded = 0;  // so far only useful in Inactive turn
             status.m_paybacked = 0;  // ditto
         }
@@ -1289,6 +1379,7 @@ template<>
 inline void perform_skill<Skill::enhance>(Field* fd, CardStatus* src, CardStatus* dst, const SkillSpec& s)
 {
     dst->m_enhanced_value[s.s + dst->m_primary_skill_offset[s.s]] += s.x;
+    dst->m_skill_modified = true;
 }
 
 template<>
@@ -1300,6 +1391,7 @@ inline void perform_skill<Skill::evolve>(Field* fd, CardStatus* src, CardStatus*
     dst->m_primary_skill_offset[s.s2] = primary_s1 - s.s2;
     dst->m_evolved_skill_offset[primary_s1] = s.s2 - primary_s1;
     dst->m_evolved_skill_offset[primary_s2] = s.s - primary_s2;
+    dst->m_skill_modified = true;
 }
 
 template<>
@@ -1530,6 +1622,7 @@ bool check_and_perform_skill(Field* fd, CardStatus* src, CardStatus* dst, const
         if (s.c > 0)
         {
             src->m_skill_cd[skill_id] = s.c;
+            src->m_has_cooldown = true;
         }
         return(true);
     }
@@ -1869,7 +1962,35 @@ void perform_targetted_hostile_fast(Field* fd, CardStatus* src, const SkillSpec&
 }
 
 //------------------------------------------------------------------------------
-Results<uint64_t> play(Field* fd)
+// True if the battle can only stall from here on, with nothing changing in the turns left (and no random number drawn):
+// no assault is on the field or left to draw, so no commander can be attacked, and none of the skills
+// that could still act (those of the commanders, structures and BGEs) is Siege or Mortar, the only ones against structures.
+bool outcome_decided(const Field* fd)
+{
+    for (const Hand* hand: fd->players)
+    {
+        if (!hand->deck->shuffled_cards.empty() || hand->assaults.size() > 0)
+        {
+            return false;
+        }
+    }
+    auto hits_structures = [](const CardStatus* status)
+    { return status->m_card->m_skill_value[Skill::siege] > 0 || status->m_card->m_skill_value[Skill::mortar] > 0; };
+    for (unsigned i = 0; i < 2; ++ i)
+    {
+        const Hand* hand = fd->players[i];
+        if (hits_structures(&hand->commander)
+            || std::any_of(hand->structures.m_indirect.begin(), hand->structures.m_indirect.end(), hits_structures)
+            || std::any_of(fd->bg_skills[i]->begin(), fd->bg_skills[i]->end(), [](const SkillSpec& ss) { return ss.id == Skill::siege || ss.id == Skill::mortar; }))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<bool has_bges, bool has_quest>
+void start_battle(Field* fd)
 {
     fd->players[0]->commander.m_player = 0;
     fd->players[1]->commander.m_player = 1;
@@ -1889,294 +2010,350 @@ Results<uint64_t> play(Field* fd)
         std::swap(fd->tapi, fd->tipi);
         std::swap(fd->tap, fd->tip);
     }
+}
 
-    while(__builtin_expect(fd->turn <= turn_limit && !fd->end, true))
-    {
-        fd->current_phase = Field::playcard_phase;
-        // Initialize stuff, remove dead cards
-        _DEBUG_MSG(1, "------------------------------------------------------------------------\n"
-                "TURN %u begins for %s\n", fd->turn, status_description(&fd->tap->commander).c_str());
-        turn_start_phase(fd);
+template<bool has_bges, bool has_quest>
+void play_turn(Field* fd)
+{
+    fd->current_phase = Field::playcard_phase;
+    // Initialize stuff, remove dead cards
+    _DEBUG_MSG(1, "------------------------------------------------------------------------\n"
+            "TURN %u begins for %s\n", fd->turn, status_description(&fd->tap->commander).c_str());
+    turn_start_phase(fd);
 
-        // Play a card
-        const Card* played_card(fd->tap->deck->next());
-        if(played_card)
+    // Play a card
+    const Card* played_card(fd->tap->deck->next());
+    if(played_card)
+    {
+        // Evaluate skill Allegiance
+        for (CardStatus * status : fd->tap->assaults.m_indirect)
         {
-            // Evaluate skill Allegiance
-            for (CardStatus * status : fd->tap->assaults.m_indirect)
-            {
-                unsigned allegiance_value = status->skill(Skill::allegiance);
-                assert(status->m_card);
-                if (allegiance_value > 0 && is_alive(status) && status->m_card->m_faction == played_card->m_faction)
-                {
-                    _DEBUG_MSG(1, "%s activates Allegiance %u\n", status_description(status).c_str(), allegiance_value);
-                    if (! status->m_sundered)
-                    { status->m_attack += allegiance_value; }
-                    status->m_max_hp += allegiance_value;
-                    status->m_hp += allegiance_value;
-                }
-            }
-            // End Evaluate skill Allegiance
-            switch(played_card->m_type)
+            unsigned allegiance_value = status->skill(Skill::allegiance);
+            assert(status->m_card);
+            if (allegiance_value > 0 && is_alive(status) && status->m_card->m_faction == played_card->m_faction)
             {
-            case CardType::assault:
-                PlayCard(played_card, fd).op<CardType::assault>();
-                break;
-            case CardType::structure:
-                PlayCard(played_card, fd).op<CardType::structure>();
-                break;
-            case CardType::commander:
-            case CardType::num_cardtypes:
-                _DEBUG_MSG(0, "Unknown card type: #%u %s: %u\n", played_card->m_id, card_description(fd->cards, played_card).c_str(), played_card->m_type);
-                assert(false);
-                break;
+                _DEBUG_MSG(1, "%s activates Allegiance %u\n", status_description(status).c_str(), allegiance_value);
+                if (! status->m_sundered)
+                { status->m_attack += allegiance_value; }
+                status->m_max_hp += allegiance_value;
+                status->m_hp += allegiance_value;
             }
         }
-        if(__builtin_expect(fd->end, false)) { break; }
+        // End Evaluate skill Allegiance
+        switch(played_card->m_type)
+        {
+        case CardType::assault:
+            PlayCard(played_card, fd).op<CardType::assault>();
+            break;
+        case CardType::structure:
+            PlayCard(played_card, fd).op<CardType::structure>();
+            break;
+        case CardType::commander:
+        case CardType::num_cardtypes:
+            _DEBUG_MSG(0, "Unknown card type: #%u %s: %u\n", played_card->m_id, card_description(fd->cards, played_card).c_str(), played_card->m_type);
+            assert(false);
+            break;
+        }
+    }
+    if(__builtin_expect(fd->end, false)) { return; }
 
-        // Evaluate Heroism BGE skills
-        if (fd->bg_effects.count(PassiveBGE::heroism))
+    // Evaluate Heroism BGE skills
+    if (has_bges && fd->bg_effects.count(PassiveBGE::heroism))
+    {
+        for (CardStatus * dst: fd->tap->assaults.m_indirect)
         {
-            for (CardStatus * dst: fd->tap->assaults.m_indirect)
+            unsigned bge_value = (dst->skill(Skill::valor) + 1) / 2;
+            if (bge_value <= 0)
+            { continue; }
+            SkillSpec ss_protect{Skill::protect, bge_value, allfactions, 0, 0, Skill::no_skill, Skill::no_skill, false,};
+            if (dst->m_inhibited > 0)
             {
-                unsigned bge_value = (dst->skill(Skill::valor) + 1) / 2;
-                if (bge_value <= 0)
-                { continue; }
-                SkillSpec ss_protect{Skill::protect, bge_value, allfactions, 0, 0, Skill::no_skill, Skill::no_skill, false,};
-                if (dst->m_inhibited > 0)
+                _DEBUG_MSG(1, "Heroism: %s on %s but it is inhibited\n", skill_short_description(ss_protect).c_str(), status_description(dst).c_str());
+                -- dst->m_inhibited;
+                if (fd->bg_effects.count(PassiveBGE::divert))
                 {
-                    _DEBUG_MSG(1, "Heroism: %s on %s but it is inhibited\n", skill_short_description(ss_protect).c_str(), status_description(dst).c_str());
-                    -- dst->m_inhibited;
-                    if (fd->bg_effects.count(PassiveBGE::divert))
+                    SkillSpec diverted_ss = ss_protect;
+                    diverted_ss.y = allfactions;
+                    diverted_ss.n = 1;
+                    diverted_ss.all = false;
+                    // for (unsigned i = 0; i < num_inhibited; ++ i)
                     {
-                        SkillSpec diverted_ss = ss_protect;
-                        diverted_ss.y = allfactions;
-                        diverted_ss.n = 1;
-                        diverted_ss.all = false;
-                        // for (unsigned i = 0; i < num_inhibited; ++ i)
+                        select_targets<Skill::protect>(fd, &fd->tip->commander, diverted_ss);
+                        for (CardStatus * dst: fd->selection_array)
                         {
-                            select_targets<Skill::protect>(fd, &fd->tip->commander, diverted_ss);
-                            for (CardStatus * dst: fd->selection_array)
+                            if (dst->m_inhibited > 0)
                             {
-                                if (dst->m_inhibited > 0)
-                                {
-                                    _DEBUG_MSG(1, "Heroism: %s (Diverted) on %s but it is inhibited\n", skill_short_description(diverted_ss).c_str(), status_description(dst).c_str());
-                                    -- dst->m_inhibited;
-                                    continue;
-                                }
-                                _DEBUG_MSG(1, "Heroism: %s (Diverted) on %s\n", skill_short_description(diverted_ss).c_str(), status_description(dst).c_str());
-                                perform_skill<Skill::protect>(fd, &fd->tap->commander, dst, diverted_ss);  // XXX: the caster
+                                _DEBUG_MSG(1, "Heroism: %s (Diverted) on %s but it is inhibited\n", skill_short_description(diverted_ss).c_str(), status_description(dst).c_str());
+                                -- dst->m_inhibited;
+                                continue;
                             }
+                            _DEBUG_MSG(1, "Heroism: %s (Diverted) on %s\n", skill_short_description(diverted_ss).c_str(), status_description(dst).c_str());
+                            perform_skill<Skill::protect>(fd, &fd->tap->commander, dst, diverted_ss);  // XXX: the caster
                         }
                     }
-                    continue;
                 }
-                bool has_counted_quest = false;
-                check_and_perform_skill<Skill::protect>(fd, &fd->tap->commander, dst, ss_protect, false, has_counted_quest);
+                continue;
             }
+            bool has_counted_quest = false;
+            check_and_perform_skill<Skill::protect>(fd, &fd->tap->commander, dst, ss_protect, false, has_counted_quest);
         }
+    }
 
-        // Evaluate activation BGE skills
-        for (const auto & bg_skill: fd->bg_skills[fd->tapi])
-        {
-            _DEBUG_MSG(2, "Evaluating BG skill %s\n", skill_description(fd->cards, bg_skill).c_str());
-            fd->skill_queue.emplace_back(&fd->tap->commander, bg_skill);
-            resolve_skill(fd);
-        }
-        if (__builtin_expect(fd->end, false)) { break; }
+    // Evaluate activation BGE skills
+    for (const auto & bg_skill: *fd->bg_skills[fd->tapi])
+    {
+        _DEBUG_MSG(2, "Evaluating BG skill %s\n", skill_description(fd->cards, bg_skill).c_str());
+        fd->skill_queue.emplace_back(&fd->tap->commander, bg_skill);
+        resolve_skill(fd);
+    }
+    if (__builtin_expect(fd->end, false)) { return; }
 
-        // Evaluate commander
-        fd->current_phase = Field::commander_phase;
-        evaluate_skills<CardType::commander>(fd, &fd->tap->commander, fd->tap->commander.m_card->m_skills);
-        if(__builtin_expect(fd->end, false)) { break; }
+    // Evaluate commander
+    fd->current_phase = Field::commander_phase;
+    evaluate_skills<CardType::commander>(fd, &fd->tap->commander);
+    if(__builtin_expect(fd->end, false)) { return; }
 
-        // Evaluate structures
-        fd->current_phase = Field::structures_phase;
-        for(fd->current_ci = 0; !fd->end && fd->current_ci < fd->tap->structures.size(); ++fd->current_ci)
+    // Evaluate structures
+    fd->current_phase = Field::structures_phase;
+    for(fd->current_ci = 0; !fd->end && fd->current_ci < fd->tap->structures.size(); ++fd->current_ci)
+    {
+        CardStatus* current_status(&fd->tap->structures[fd->current_ci]);
+        if (!is_active(current_status))
         {
-            CardStatus* current_status(&fd->tap->structures[fd->current_ci]);
-            if (!is_active(current_status))
-            {
-                _DEBUG_MSG(2, "%s cannot take action.\n", status_description(current_status).c_str());
-            }
-            else
+            _DEBUG_MSG(2, "%s cannot take action.\n", status_description(current_status).c_str());
+        }
+        else
+        {
+            evaluate_skills<CardType::structure>(fd, current_status);
+        }
+    }
+    // Evaluate assaults
+    fd->current_phase = Field::assaults_phase;
+    fd->bloodlust_value = 0;
+    for(fd->current_ci = 0; !fd->end && fd->current_ci < fd->tap->assaults.size(); ++fd->current_ci)
+    {
+        // ca: current assault
+        CardStatus* current_status(&fd->tap->assaults[fd->current_ci]);
+        // aa: across assault
+        CardStatus* across_status(fd->current_ci < fd->tip->assaults.size() ? &fd->tip->assaults[fd->current_ci] : NULL);
+        bool attacked = false;
+        if (!is_active(current_status))
+        {
+            _DEBUG_MSG(2, "%s cannot take action.\n", status_description(current_status).c_str());
+            // evals Halted Orders BGE
+            unsigned inhibit_value;
+            if (has_bges && fd->bg_effects.count(PassiveBGE::haltedorders) && (current_status->m_delay > 0) && across_status && is_alive(across_status)
+                && (inhibit_value = current_status->skill(Skill::inhibit)) > across_status->m_inhibited)
             {
-                evaluate_skills<CardType::structure>(fd, current_status, current_status->m_card->m_skills);
+                _DEBUG_MSG(1, "Halted Orders: %s inhibits %s by %u\n",
+                    status_description(current_status).c_str(), status_description(across_status).c_str(), inhibit_value);
+                across_status->m_inhibited = inhibit_value;
             }
         }
-        // Evaluate assaults
-        fd->current_phase = Field::assaults_phase;
-        fd->bloodlust_value = 0;
-        for(fd->current_ci = 0; !fd->end && fd->current_ci < fd->tap->assaults.size(); ++fd->current_ci)
-        {
-            // ca: current assault
-            CardStatus* current_status(&fd->tap->assaults[fd->current_ci]);
-            // aa: across assault
-            CardStatus* across_status(fd->current_ci < fd->tip->assaults.size() ? &fd->tip->assaults[fd->current_ci] : NULL);
-            bool attacked = false;
-            if (!is_active(current_status))
+        else
+        {
+            fd->assault_bloodlusted = false;
+            current_status->m_step = CardStep::attacking;
+            evaluate_skills<CardType::assault>(fd, current_status, &attacked);
+            if (__builtin_expect(fd->end, false)) { break; }
+        }
+        if (current_status->m_corroded_rate > 0)
+        {
+            if (attacked)
             {
-                _DEBUG_MSG(2, "%s cannot take action.\n", status_description(current_status).c_str());
-                // evals Halted Orders BGE
-                unsigned inhibit_value;
-                if (fd->bg_effects.count(PassiveBGE::haltedorders) && (current_status->m_delay > 0) && across_status && is_alive(across_status)
-                    && (inhibit_value = current_status->skill(Skill::inhibit)) > across_status->m_inhibited)
-                {
-                    _DEBUG_MSG(1, "Halted Orders: %s inhibits %s by %u\n",
-                        status_description(current_status).c_str(), status_description(across_status).c_str(), inhibit_value);
-                    across_status->m_inhibited = inhibit_value;
-                }
+                unsigned v = std::min(current_status->m_corroded_rate, attack_power(current_status));
+                _DEBUG_MSG(1, "%s loses Attack by %u.\n", status_description(current_status).c_str(), v);
+                current_status->m_corroded_weakened += v;
             }
             else
             {
-                fd->assault_bloodlusted = false;
-                current_status->m_step = CardStep::attacking;
-                evaluate_skills<CardType::assault>(fd, current_status, current_status->m_card->m_skills, &attacked);
-                if (__builtin_expect(fd->end, false)) { break; }
-            }
-            if (current_status->m_corroded_rate > 0)
-            {
-                if (attacked)
-                {
-                    unsigned v = std::min(current_status->m_corroded_rate, attack_power(current_status));
-                    _DEBUG_MSG(1, "%s loses Attack by %u.\n", status_description(current_status).c_str(), v);
-                    current_status->m_corroded_weakened += v;
-                }
-                else
-                {
-                    _DEBUG_MSG(1, "%s loses Status corroded.\n", status_description(current_status).c_str());
-                    current_status->m_corroded_rate = 0;
-                    current_status->m_corroded_weakened = 0;
-                }
+                _DEBUG_MSG(1, "%s loses Status corroded.\n", status_description(current_status).c_str());
+                current_status->m_corroded_rate = 0;
+                current_status->m_corroded_weakened = 0;
             }
-            current_status->m_step = CardStep::attacked;
         }
-        fd->current_phase = Field::end_phase;
-        turn_end_phase(fd);
-        if(__builtin_expect(fd->end, false)) { break; }
-        _DEBUG_MSG(1, "TURN %u ends for %s\n", fd->turn, status_description(&fd->tap->commander).c_str());
-        std::swap(fd->tapi, fd->tipi);
-        std::swap(fd->tap, fd->tip);
-        ++fd->turn;
+        current_status->m_step = CardStep::attacked;
     }
-    const auto & p = fd->players;
-    unsigned raid_damage = 0;
-    unsigned quest_score = 0;
-    switch (fd->optimization_mode)
+    fd->current_phase = Field::end_phase;
+    turn_end_phase(fd);
+    if(__builtin_expect(fd->end, false)) { return; }
+    _DEBUG_MSG(1, "TURN %u ends for %s\n", fd->turn, status_description(&fd->tap->commander).c_str());
+    std::swap(fd->tapi, fd->tipi);
+    std::swap(fd->tap, fd->tip);
+    ++fd->turn;
+    // a quest may still count the skills used (e.g. Flurry) in the turns left
+    if (!has_quest && fd->turn <= turn_limit && outcome_decided(fd))
     {
-        case OptimizationMode::raid:
-            raid_damage = 15 + (std::min<unsigned>(p[1]->deck->deck_size, (fd->turn + 1) / 2) - p[1]->assaults.size() - p[1]->structures.size()) - (10 * p[1]->commander.m_hp / p[1]->commander.m_max_hp);
-            break;
-        case OptimizationMode::quest:
-            if (fd->quest.quest_type == QuestType::card_survival)
-            {
-                for (const auto & status: p[0]->assaults.m_indirect)
-                { fd->quest_counter += (fd->quest.quest_key == status->m_card->m_id); }
-                for (const auto & status: p[0]->structures.m_indirect)
-                { fd->quest_counter += (fd->quest.quest_key == status->m_card->m_id); }
-                for (const auto & card: p[0]->deck->shuffled_cards)
-                { fd->quest_counter += (fd->quest.quest_key == card->m_id); }
-            }
-            quest_score = fd->quest.must_fulfill ? (fd->quest_counter >= fd->quest.quest_value ? fd->quest.quest_score : 0) : std::min<unsigned>(fd->quest.quest_score, fd->quest.quest_score * fd->quest_counter / fd->quest.quest_value);
-            _DEBUG_MSG(1, "Quest: %u / %u = %u%%.\n", fd->quest_counter, fd->quest.quest_value, quest_score);
-            break;
-        default:
-            break;
+        _DEBUG_MSG(1, "Nothing can change in the %u turns left.\n", turn_limit + 1 - fd->turn);
+        fd->turns_saved = turn_limit + 1 - fd->turn;
+        fd->turn = turn_limit + 1;
     }
-    // you lose
-    if(!is_alive(&fd->players[0]->commander))
+}
+
+ScoreTable::ScoreTable(OptimizationMode mode, const Quest & quest)
+{
+    for (auto & end: ends)
     {
-        _DEBUG_MSG(1, "You lose.\n");
-        switch (fd->optimization_mode)
+        end.bucket = no_bucket;
+        end.points.assign((turn_limit + 2) * num_buckets, 0);
+        end.per_unit.fill(0);
+        end.per_card_left.fill(0);
+        end.per_card_drawn.fill(0);
+        end.per_quest_score = 0;
+    }
+    ends[loss].result = {0, 0, 1, 0};
+    ends[win].result = {1, 0, 0, 0};
+    ends[stall].result = {0, 1, 0, 0};
+    auto fill = [this](End end, Bucket bucket, std::function<unsigned(unsigned turn, unsigned bucket)> points)
+    {
+        ends[end].bucket = bucket;
+        for (unsigned turn = 0; turn <= turn_limit + 1; ++ turn)
         {
-        case OptimizationMode::raid: return {0, 0, 1, raid_damage};
-        case OptimizationMode::brawl: return {0, 0, 1, 5};
-        case OptimizationMode::brawl_defense:
-            {
-                unsigned enemy_brawl_score = 57
-                    - (10 * (p[1]->commander.m_max_hp - p[1]->commander.m_hp) / p[1]->commander.m_max_hp)
-                    + (p[1]->assaults.size() + p[1]->structures.size() + p[1]->deck->shuffled_cards.size())
-                    - (p[0]->assaults.size() + p[0]->structures.size() + p[0]->deck->shuffled_cards.size())
-                    - fd->turn / 4;
-                unsigned max_score = max_possible_score[(size_t)OptimizationMode::brawl_defense];
-                return {0, 0, 1, max_score - enemy_brawl_score};
-            }
-        case OptimizationMode::quest: return {0, 0, 1, fd->quest.must_win ? 0 : quest_score};
-        default: return {0, 0, 1, 0};
+            for (unsigned b = 0; b < num_buckets; ++ b)
+            { ends[end].points[turn * num_buckets + b] = points(turn, b); }
         }
-    }
-    // you win
-    if(!is_alive(&fd->players[1]->commander))
+    };
+    auto constant = [](unsigned points) { return [points](unsigned, unsigned) { return points; }; };
+    fill(win, no_bucket, constant(100));
+    switch (mode)
     {
-        _DEBUG_MSG(1, "You win.\n");
-        switch (fd->optimization_mode)
+    case OptimizationMode::raid:
+        // raid damage: 15 + (cards the enemy has drawn - its units) - 10 * its commander hp / max hp
+        for (End end: {loss, stall})
         {
-        case OptimizationMode::brawl:
-            {
-                unsigned brawl_score = 57
-                    - (10 * (p[0]->commander.m_max_hp - p[0]->commander.m_hp) / p[0]->commander.m_max_hp)
-                    + (p[0]->assaults.size() + p[0]->structures.size() + p[0]->deck->shuffled_cards.size())
-                    - (p[1]->assaults.size() + p[1]->structures.size() + p[1]->deck->shuffled_cards.size())
-                    - fd->turn / 4;
-                return {1, 0, 0, brawl_score};
-            }
-        case OptimizationMode::brawl_defense:
-            {
-                //unsigned max_score = max_possible_score[(size_t)OptimizationMode::brawl_defense];
-                //unsigned min_score = min_possible_score[(size_t)OptimizationMode::brawl_defense];
-                return {1, 0, 0, /* max_score - min_score */ 67 - 5};
-            }
-        case OptimizationMode::campaign:
-            {
-                unsigned campaign_score = 100 - 10 * (std::min<unsigned>(p[0]->deck->cards.size(), (fd->turn + 1) / 2) - p[0]->assaults.size() - p[0]->structures.size());
-                return {1, 0, 0, campaign_score};
-            }
-        case OptimizationMode::quest: return {1, 0, 0, fd->quest.win_score + quest_score};
-        default:
-            return {1, 0, 0, 100};
+            fill(end, enemy_hp, [](unsigned, unsigned b) { return 15 - b; });
+            ends[end].per_unit[1] = -1;
+            ends[end].per_card_drawn[1] = 1;
         }
+        break;
+    case OptimizationMode::brawl:
+        fill(loss, no_bucket, constant(5));
+        fill(stall, no_bucket, constant(5));
+        fill(win, your_damage, [](unsigned turn, unsigned b) { return 57 - b - turn / 4; });
+        ends[win].per_unit = ends[win].per_card_left = {{1, -1}};
+        break;
+    case OptimizationMode::brawl_defense:
+        {
+            // the max score less the brawl score of the enemy
+            unsigned max_score = max_possible_score[(size_t)OptimizationMode::brawl_defense];
+            fill(loss, enemy_damage, [max_score](unsigned turn, unsigned b) { return max_score - 57 + b + turn / 4; });
+            ends[loss].per_unit = ends[loss].per_card_left = {{1, -1}};
+            //unsigned min_score = min_possible_score[(size_t)OptimizationMode::brawl_defense];
+            fill(win, no_bucket, constant(/* max_score - min_score */ 67 - 5));
+            ends[stall].result = {1, 0, 0, 0};
+            fill(stall, no_bucket, constant(67 - 5));
+        }
+        break;
+    case OptimizationMode::campaign:
+        // 100 - 10 * (cards you have drawn - your units)
+        ends[win].per_unit[0] = 10;
+        ends[win].per_card_drawn[0] = -10;
+        break;
+    case OptimizationMode::quest:
+        ends[loss].per_quest_score = quest.must_win ? 0 : 1;
+        fill(win, no_bucket, constant(quest.win_score));
+        ends[win].per_quest_score = 1;
+        ends[stall].per_quest_score = quest.must_win ? 0 : 1;
+        break;
+    case OptimizationMode::defense:
+        fill(stall, no_bucket, constant(100));
+        break;
+    default:
+        break;
+    }
+}
+
+Results<uint64_t> ScoreTable::score(const BattleOutcome & outcome, unsigned quest_score) const
+{
+    const auto & o = outcome;
+    End end = stall;
+    if (o.commander_hp[0] == 0)
+    {
+        _DEBUG_MSG(1, "You lose.\n");
+        end = loss;
+    }
+    else if (o.commander_hp[1] == 0)
+    {
+        _DEBUG_MSG(1, "You win.\n");
+        end = win;
     }
-    if (fd->turn > turn_limit)
+    else
     {
+        assert(o.turn > turn_limit);
         _DEBUG_MSG(1, "Stall after %u turns.\n", turn_limit);
-        switch (fd->optimization_mode)
+    }
+    const EndScore & e = ends[end];
+    unsigned bucket = 0;
+    switch (e.bucket)
+    {
+    case no_bucket: break;
+    case your_damage: bucket = 10 * (o.commander_max_hp[0] - o.commander_hp[0]) / o.commander_max_hp[0]; break;
+    case enemy_hp: bucket = 10 * o.commander_hp[1] / o.commander_max_hp[1]; break;
+    case enemy_damage: bucket = 10 * (o.commander_max_hp[1] - o.commander_hp[1]) / o.commander_max_hp[1]; break;
+    }
+    assert(bucket < num_buckets && (o.turn + 1) * num_buckets <= e.points.size());
+    unsigned points = e.points[o.turn * num_buckets + bucket];
+    const unsigned deck_size[2] = {o.your_deck_size, o.enemy_deck_size};
+    for (unsigned i = 0; i < 2; ++ i)
+    {
+        points += e.per_unit[i] * o.num_units[i] + e.per_card_left[i] * o.num_cards_left[i]
+            + e.per_card_drawn[i] * std::min(deck_size[i], (o.turn + 1) / 2);
+    }
+    points += e.per_quest_score * quest_score;
+    return {e.result.wins, e.result.draws, e.result.losses, points};
+}
+
+template<bool has_bges, bool has_quest>
+Results<uint64_t> battle_result(Field* fd)
+{
+    const auto & p = fd->players;
+    unsigned quest_score = 0;
+    if (has_quest && fd->optimization_mode == OptimizationMode::quest)
+    {
+        if (fd->quest.quest_type == QuestType::card_survival)
         {
-        case OptimizationMode::defense: return {0, 1, 0, 100};
-        case OptimizationMode::raid: return {0, 1, 0, raid_damage};
-        case OptimizationMode::brawl: return {0, 1, 0, 5};
-        case OptimizationMode::brawl_defense:
-            {
-                //unsigned max_score = max_possible_score[(size_t)OptimizationMode::brawl_defense];
-                //unsigned min_score = min_possible_score[(size_t)OptimizationMode::brawl_defense];
-                return {1, 0, 0, /* max_score - min_score */ 67 - 5};
-            }
-        case OptimizationMode::quest: return {0, 1, 0, fd->quest.must_win ? 0 : quest_score};
-        default: return {0, 1, 0, 0};
+            for (const auto & status: p[0]->assaults.m_indirect)
+            { fd->quest_counter += (fd->quest.quest_key == status->m_card->m_id); }
+            for (const auto & status: p[0]->structures.m_indirect)
+            { fd->quest_counter += (fd->quest.quest_key == status->m_card->m_id); }
+            for (const auto & card: p[0]->deck->shuffled_cards)
+            { fd->quest_counter += (fd->quest.quest_key == card->m_id); }
         }
+        quest_score = fd->quest.must_fulfill ? (fd->quest_counter >= fd->quest.quest_value ? fd->quest.quest_score : 0) : std::min<unsigned>(fd->quest.quest_score, fd->quest.quest_score * fd->quest_counter / fd->quest.quest_value);
+        _DEBUG_MSG(1, "Quest: %u / %u = %u%%.\n", fd->quest_counter, fd->quest.quest_value, quest_score);
+    }
+    BattleOutcome outcome;
+    outcome.turn = fd->turn;
+    for (unsigned i = 0; i < 2; ++ i)
+    {
+        outcome.commander_hp[i] = p[i]->commander.m_hp;
+        outcome.commander_max_hp[i] = p[i]->commander.m_max_hp;
+        outcome.num_units[i] = p[i]->assaults.size() + p[i]->structures.size();
+        outcome.num_cards_left[i] = p[i]->deck->shuffled_cards.size();
     }
+    outcome.your_deck_size = p[0]->deck->cards.size();
+    outcome.enemy_deck_size = p[1]->deck->deck_size;
+    return fd->score_table.score(outcome, quest_score);
+}
 
-    // Huh? How did we get here?
-    assert(false);
-    return {0, 0, 0, 0};
+template<bool has_bges, bool has_quest>
+Results<uint64_t> play(Field* fd)
+{
+    start_battle<has_bges, has_quest>(fd);
+    while(__builtin_expect(!fd->over(), true))
+    {
+        play_turn<has_bges, has_quest>(fd);
+    }
+    return battle_result<has_bges, has_quest>(fd);
 }
-//------------------------------------------------------------------------------
-void fill_skill_table()
-{
-    memset(skill_table, 0, sizeof skill_table);
-    skill_table[Skill::mortar] = perform_targetted_hostile_fast<Skill::mortar>;
-    skill_table[Skill::enfeeble] = perform_targetted_hostile_fast<Skill::enfeeble>;
-    skill_table[Skill::enhance] = perform_targetted_allied_fast<Skill::enhance>;
-    skill_table[Skill::evolve] = perform_targetted_allied_fast<Skill::evolve>;
-    skill_table[Skill::heal] = perform_targetted_allied_fast<Skill::heal>;
-    skill_table[Skill::jam] = perform_targetted_hostile_fast<Skill::jam>;
-    skill_table[Skill::mend] = perform_targetted_allied_fast<Skill::mend>;
-    skill_table[Skill::overload] = perform_targetted_allied_fast<Skill::overload>;
-    skill_table[Skill::protect] = perform_targetted_allied_fast<Skill::protect>;
-    skill_table[Skill::rally] = perform_targetted_allied_fast<Skill::rally>;
-    skill_table[Skill::enrage] = perform_targetted_allied_fast<Skill::enrage>;
-    skill_table[Skill::rush] = perform_targetted_allied_fast_rush;
-    skill_table[Skill::siege] = perform_targetted_hostile_fast<Skill::siege>;
-    skill_table[Skill::strike] = perform_targetted_hostile_fast<Skill::strike>;
-    skill_table[Skill::sunder] = perform_targetted_hostile_fast<Skill::sunder>;
-    skill_table[Skill::weaken] = perform_targetted_hostile_fast<Skill::weaken>;
+
+PlayFunction play_function(bool has_bges, bool has_quest)
+{
+    return has_bges ? (has_quest ? play<true, true> : play<true, false>) : (has_quest ? play<false, true> : play<false, false>);
+}
+
+BattleSteps battle_steps(bool has_bges, bool has_quest)
+{
+    return has_bges ? (has_quest ? BattleSteps{start_battle<true, true>, play_turn<true, true>, battle_result<true, true>} : BattleSteps{start_battle<true, false>, play_turn<true, false>, battle_result<true, false>})
+        : (has_quest ? BattleSteps{start_battle<false, true>, play_turn<false, true>, battle_result<false, true>} : BattleSteps{start_battle<false, false>, play_turn<false, false>, battle_result<false, false>});
 }
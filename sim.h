@@ -12,10 +12,10 @@
 #include <random>
 
 #include "tyrant.h"
+#include "deck.h"
 
 class Card;
 class Cards;
-class Deck;
 class Field;
 class Achievement;
 
@@ -59,8 +59,58 @@ struct FinalResults
     uint64_t n_sims;
 };
 
-void fill_skill_table();
-Results<uint64_t> play(Field* fd);
+// play() instantiated with or without passive BGEs and quest scoring; choose one with play_function() once per run.
+template<bool has_bges, bool has_quest> Results<uint64_t> play(Field* fd);
+typedef Results<uint64_t> (*PlayFunction)(Field* fd);
+PlayFunction play_function(bool has_bges, bool has_quest);
+// The steps of play() for callers that stop between turns, e.g. to save the battle with Field::save():
+// start plays the fortresses, play_turn one turn until the field is over(), result scores the battle.
+struct BattleSteps
+{
+    void (*start)(Field* fd);
+    void (*play_turn)(Field* fd);
+    Results<uint64_t> (*result)(Field* fd);
+};
+BattleSteps battle_steps(bool has_bges, bool has_quest);
+// What the score of a finished battle depends on (see ScoreTable::score()).
+struct BattleOutcome
+{
+    unsigned turn;
+    std::array<unsigned, 2> commander_hp;
+    std::array<unsigned, 2> commander_max_hp;
+    std::array<unsigned, 2> num_units;  // assaults and structures on the field, dead or alive
+    std::array<unsigned, 2> num_cards_left;  // not drawn yet
+    unsigned your_deck_size;  // cards of your deck
+    unsigned enemy_deck_size;  // deck_size of the enemy deck
+};
+struct Quest;
+// The scores of finished battles in one optimization mode, built once per run: each end of a battle (loss, win or stall)
+// has a table of points by turn and commander hp bucket (10 * hp / max hp, or the same of the damage), and the number
+// of points each unit and card left adds; score() looks the points up instead of working out the rules of the mode.
+class ScoreTable
+{
+public:
+    ScoreTable(OptimizationMode mode, const Quest & quest);
+    Results<uint64_t> score(const BattleOutcome & outcome, unsigned quest_score) const;
+
+private:
+    enum End { loss, win, stall, num_ends };
+    enum Bucket { no_bucket, your_damage, enemy_hp, enemy_damage };
+    static const unsigned num_buckets = 11;
+    struct EndScore
+    {
+        Results<uint64_t> result;  // wins, draws and losses; the points are the sum below
+        Bucket bucket;
+        std::vector<unsigned> points;  // [turn * num_buckets + bucket]
+        // points for each unit on the field, card left and card drawn (as if one per turn of the side) of either side;
+        // may be negative, summed modulo 2^32 as the points have always been
+        std::array<int, 2> per_unit;
+        std::array<int, 2> per_card_left;
+        std::array<int, 2> per_card_drawn;
+        unsigned per_quest_score;
+    };
+    std::array<EndScore, num_ends> ends;
+};
 // Pool-based indexed storage.
 //---------------------- Pool-based indexed storage ----------------------------
 template<typename T>
@@ -166,6 +216,8 @@ struct CardStatus
     signed m_evolved_skill_offset[Skill::num_skills];
     unsigned m_enhanced_value[Skill::num_skills];
     unsigned m_skill_cd[Skill::num_skills];
+    bool m_skill_modified;  // Enhance/Evolve changed the arrays above since the last reset
+    bool m_has_cooldown;  // some m_skill_cd may be > 0
 
     CardStatus() {}
 
@@ -194,6 +246,17 @@ public:
 
     void reset(std::mt19937& re);
 
+    // State of the hand between turns; see Field::save().
+    struct Snapshot
+    {
+        CardStatus commander;
+        std::vector<CardStatus> assaults;
+        std::vector<CardStatus> structures;
+        Deck::DrawState deck;
+    };
+    void save(Snapshot& snapshot) const;
+    void restore(const Snapshot& snapshot);
+
     Deck* deck;
     CardStatus commander;
     Storage<CardStatus> assaults;
@@ -221,6 +284,32 @@ struct Quest
     {}
 };
 
+//------------------------------------------------------------------------------
+// Passive BGEs of a battle: the values indexed by PassiveBGE, and a bit for each BGE present.
+// Built once from the map of the command line; count() and at() work as they do on the map.
+class BGEffects
+{
+public:
+    BGEffects(const std::unordered_map<unsigned, unsigned>& bg_effects) :
+        m_present(0)
+    {
+        static_assert(PassiveBGE::num_passive_bges <= 32, "a bit for each passive BGE");
+        m_values.fill(0);
+        for (const auto & bg_effect: bg_effects)
+        {
+            m_values[bg_effect.first] = bg_effect.second;
+            m_present |= 1u << bg_effect.first;
+        }
+    }
+    bool any() const { return(m_present != 0); }
+    unsigned count(unsigned bge_id) const { return((m_present >> bge_id) & 1u); }
+    unsigned at(unsigned bge_id) const { assert(count(bge_id)); return(m_values[bge_id]); }
+
+private:
+    std::array<unsigned, PassiveBGE::num_passive_bges> m_values;
+    unsigned m_present;
+};
+//------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 // struct Field is the data model of a battle:
 // an attacker and a defender deck, list of assaults and structures, etc.
@@ -238,11 +327,14 @@ public:
     Hand* tip;
     std::vector<CardStatus*> selection_array;
     unsigned turn;
+    unsigned turns_saved;  // turns skipped once outcome_decided() found nothing could change any more
+    unsigned num_draws;  // random numbers drawn by rand(): with none, the battle does not depend on re
     gamemode_t gamemode;
     OptimizationMode optimization_mode;
     const Quest quest;
-    std::unordered_map<unsigned, unsigned> bg_effects; // passive BGE
-    std::vector<SkillSpec> bg_skills[2]; // active BGE, casted every turn
+    const ScoreTable& score_table;
+    const BGEffects& bg_effects; // passive BGE
+    const std::vector<SkillSpec>* bg_skills[2]; // active BGE, casted every turn
     // With the introduction of on death skills, a single skill can trigger arbitrary many skills.
     // They are stored in this, and cleared after all have been performed.
     std::deque<std::tuple<CardStatus*, SkillSpec>> skill_queue;
@@ -268,25 +360,47 @@ public:
     unsigned quest_counter;
 
     Field(std::mt19937& re_, const Cards& cards_, Hand& hand1, Hand& hand2, gamemode_t gamemode_, OptimizationMode optimization_mode_, const Quest & quest_,
-            std::unordered_map<unsigned, unsigned>& bg_effects_, std::vector<SkillSpec>& your_bg_skills_, std::vector<SkillSpec>& enemy_bg_skills_) :
+            const ScoreTable& score_table_, const BGEffects& bg_effects_, const std::vector<SkillSpec>& your_bg_skills_, const std::vector<SkillSpec>& enemy_bg_skills_) :
         end{false},
         re(re_),
         cards(cards_),
         players{{&hand1, &hand2}},
         turn(1),
+        turns_saved(0),
+        num_draws(0),
         gamemode(gamemode_),
         optimization_mode(optimization_mode_),
         quest(quest_),
+        score_table(score_table_),
         bg_effects{bg_effects_},
-        bg_skills{your_bg_skills_, enemy_bg_skills_},
+        bg_skills{&your_bg_skills_, &enemy_bg_skills_},
         assault_bloodlusted(false),
         bloodlust_value(0),
         quest_counter(0)
     {
     }
 
+    // State of the battle between turns, including the random engine: restore() resumes the battle where save() left it,
+    // so that a shared beginning can be played once and forked into several continuations.
+    struct Snapshot
+    {
+        std::mt19937 re;
+        bool end;
+        unsigned tapi;
+        unsigned turn;
+        bool assault_bloodlusted;
+        unsigned bloodlust_value;
+        unsigned quest_counter;
+        unsigned num_draws;
+        std::array<Hand::Snapshot, 2> players;
+    };
+    void save(Snapshot& snapshot) const;
+    void restore(const Snapshot& snapshot);
+    bool over() const { return(end || turn > turn_limit); }
+
     inline unsigned rand(unsigned x, unsigned y)
     {
+        ++ num_draws;
         return(std::uniform_int_distribution<unsigned>(x, y)(re));
     }
 
@@ -309,9 +423,11 @@ public:
     inline const std::vector<CardStatus *> adjacent_assaults(const CardStatus * status);
     inline void print_selection_array();
 
+    // Called from the skill and damage helpers, which are shared by every play() instantiation: without a quest,
+    // quest.quest_type is QuestType::none and the first test fails, so has_quest does not skip these calls.
     inline void inc_counter(QuestType::QuestType quest_type, unsigned quest_key, unsigned quest_2nd_key = 0, unsigned value = 1)
     {
-        if (quest.quest_type == quest_type && quest.quest_key == quest_key && (quest.quest_2nd_key == 0 || quest.quest_2nd_key == quest_2nd_key))
+        if (__builtin_expect(quest.quest_type == quest_type, false) && quest.quest_key == quest_key && (quest.quest_2nd_key == 0 || quest.quest_2nd_key == quest_2nd_key))
         {
             quest_counter += value;
         }
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Measure candidate generation throughput (deck cost / adjust_deck) of one or more tuo builds:
+# climb with so few simulations per deck that building and costing the candidates dominates.
+# usage: bench-candidates.sh <owned cards file> <fund> <your deck> <enemy deck> <tuo> [<tuo> ...]
+
+OWNED_FILE="$1"
+FUND="$2"
+YOUR_DECK="$3"
+ENEMY_DECK="$4"
+shift 4
+
+declare -i RUNS=5
+
+die() {
+    echo " ** ERROR ** $@" 1>&2
+    exit 255
+}
+
+[[ -f $OWNED_FILE && -n $FUND && -n $YOUR_DECK && -n $ENEMY_DECK && $# -gt 0 ]] \
+    || die "usage: $0 <owned cards file> <fund> <your deck> <enemy deck> <tuo> [<tuo> ...]"
+
+for TUO in "$@"; do
+    [[ -x $TUO ]] || die "Not an executable: $TUO"
+    declare -i DECKS=0
+    START=$(date +%s.%N)
+    for ((SEED = 1; SEED <= RUNS; ++SEED)); do
+        N=$("$TUO" "$YOUR_DECK" "$ENEMY_DECK" climb 1 -t 1 seed $SEED -o="$OWNED_FILE" fund "$FUND" 2>/dev/null \
+            | sed -n 's/^Evaluated \([0-9]*\) decks.*/\1/p')
+        DECKS+=${N:-0}
+    done
+    END=$(date +%s.%N)
+    awk -v tuo="$TUO" -v decks=$DECKS -v start=$START -v end=$END 'BEGIN { printf "%s: %d decks in %.2f s (%.1f decks/s)\n", tuo, decks, end - start, decks / (end - start) }'
+done
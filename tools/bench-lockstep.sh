@@ -0,0 +1,28 @@
+#!/bin/bash
+# Measure the battles/s of the usual engine and of +lockstep on one matchup, and check that the lanes
+# play every battle as the usual engine would (+lockstep-check replays each of them).
+# usage: bench-lockstep.sh <your deck> <enemy deck> <num battles> <tuo> [<tuo flags> ...]
+
+YOUR_DECK="$1"
+ENEMY_DECK="$2"
+declare -i BATTLES="$3"
+TUO="$4"
+shift 4
+
+die() {
+    echo " ** ERROR ** $@" 1>&2
+    exit 255
+}
+
+[[ -n $YOUR_DECK && -n $ENEMY_DECK && $BATTLES -gt 0 && -x $TUO ]] \
+    || die "usage: $0 <your deck> <enemy deck> <num battles> <tuo> [<tuo flags> ...]"
+
+for ENGINE in "" "+lockstep"; do
+    START=$(date +%s.%N)
+    RESULT=$("$TUO" "$YOUR_DECK" "$ENEMY_DECK" sim $BATTLES -t 1 seed 1 $ENGINE "$@" 2>/dev/null | grep -E '^(win|stall|loss)%|^score' | tr '\n' ' ')
+    END=$(date +%s.%N)
+    awk -v engine="${ENGINE:-usual}" -v battles=$BATTLES -v start=$START -v end=$END -v result="$RESULT" \
+        'BEGIN { printf "%-9s %.0f battles/s  %s\n", engine, battles / (end - start), result }'
+done
+"$TUO" "$YOUR_DECK" "$ENEMY_DECK" sim $BATTLES -t 1 seed 2 +lockstep-check "$@" 2>/dev/null | grep '^lockstep:' \
+    || die "no lockstep report"
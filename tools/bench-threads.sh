@@ -0,0 +1,37 @@
+#!/bin/bash
+# Measure how the battles/s of one matchup scale with the number of threads, from 1 to all the cores:
+# each run plays the same number of battles; speedup and efficiency are relative to 1 thread.
+# Pass +pin among the flags to pin each thread to a CPU.
+# usage: bench-threads.sh <your deck> <enemy deck> <num battles> <tuo> [<tuo flags> ...]
+
+YOUR_DECK="$1"
+ENEMY_DECK="$2"
+declare -i BATTLES="$3"
+TUO="$4"
+shift 4
+
+die() {
+    echo " ** ERROR ** $@" 1>&2
+    exit 255
+}
+
+[[ -n $YOUR_DECK && -n $ENEMY_DECK && $BATTLES -gt 0 && -x $TUO ]] \
+    || die "usage: $0 <your deck> <enemy deck> <num battles> <tuo> [<tuo flags> ...]"
+
+declare -i CORES=$(nproc 2>/dev/null || getconf _NPROCESSORS_ONLN)
+THREADS=()
+for ((T = 1; T < CORES; T *= 2)); do
+    THREADS+=($T)
+done
+THREADS+=($CORES)
+
+BASE_RATE=""
+for T in "${THREADS[@]}"; do
+    START=$(date +%s.%N)
+    "$TUO" "$YOUR_DECK" "$ENEMY_DECK" sim $BATTLES -t $T seed 1 "$@" >/dev/null 2>&1 || die "$TUO failed with -t $T"
+    END=$(date +%s.%N)
+    RATE=$(awk -v battles=$BATTLES -v start=$START -v end=$END 'BEGIN { printf "%.0f", battles / (end - start) }')
+    BASE_RATE=${BASE_RATE:-$RATE}
+    awk -v threads=$T -v rate=$RATE -v base=$BASE_RATE \
+        'BEGIN { printf "%3d threads: %9d battles/s  speedup %5.2f  efficiency %3.0f%%\n", threads, rate, rate / base, 100 * rate / base / threads }'
+done
@@ -0,0 +1,41 @@
+#!/bin/bash
+# Check that batch gives every job of a jobs file the same output as running the job on its own with the same suffixes and flags,
+# and that no job fails. Run it with a _suffix to check that the jobs load the suffixed data files.
+# usage: check-batch.sh <tuo> <jobs file> [_suffix ...] [<tuo flags> ...]
+
+TUO="$1"
+JOBS="$2"
+shift 2
+
+die() {
+    echo " ** ERROR ** $@" 1>&2
+    exit 255
+}
+
+[[ -x $TUO && -f $JOBS ]] || die "usage: $0 <tuo> <jobs file> [_suffix ...] [<tuo flags> ...]"
+
+# the same battles in both runs
+FLAGS=(-t 1 seed 1 "$@")
+
+BATCH_OUTPUT=$("$TUO" batch "$JOBS" "${FLAGS[@]}" 2>/dev/null) || die "$TUO batch $JOBS failed"
+
+declare -i NUM_LINE=0 FAILED=0
+while IFS= read -r LINE || [[ -n $LINE ]]; do
+    NUM_LINE+=1
+    LINE="${LINE#"${LINE%%[![:space:]]*}"}"
+    LINE="${LINE%"${LINE##*[![:space:]]}"}"
+    [[ -z $LINE || $LINE == //* ]] && continue
+    eval "ARGS=($LINE)"
+    # the output of the job in the batch: from its header to the next one
+    JOB_OUTPUT=$(awk -v header="// Job $NUM_LINE: $LINE" '$0 == header { job = 1; next } /^\/\/ Job / { job = 0 } job' <<< "$BATCH_OUTPUT")
+    if ! OWN_OUTPUT=$("$TUO" "${ARGS[@]:0:2}" "${FLAGS[@]}" "${ARGS[@]:2}" 2>/dev/null); then
+        echo "FAILED: line $NUM_LINE: $LINE"
+        FAILED+=1
+    elif [[ -z $JOB_OUTPUT || $JOB_OUTPUT != "$OWN_OUTPUT" ]]; then
+        echo "DIFFERENT: line $NUM_LINE: $LINE"
+        FAILED+=1
+    else
+        echo "same: line $NUM_LINE: $LINE"
+    fi
+done < "$JOBS"
+exit $FAILED
@@ -0,0 +1,36 @@
+#!/bin/bash
+# Run the same fixed-seed climb/reorder commands with two tuo builds and report any difference in their output.
+# usage: compare-climb.sh <old tuo> <new tuo> <your deck> <enemy deck>
+
+OLD_TUO="$1"
+NEW_TUO="$2"
+YOUR_DECK="$3"
+ENEMY_DECK="$4"
+
+die() {
+    echo " ** ERROR ** $@" 1>&2
+    exit 255
+}
+
+[[ -x $OLD_TUO && -x $NEW_TUO ]] || die "usage: $0 <old tuo> <new tuo> <your deck> <enemy deck>"
+[[ -n $YOUR_DECK && -n $ENEMY_DECK ]] || die "usage: $0 <old tuo> <new tuo> <your deck> <enemy deck>"
+
+CASES=(
+    "climb 300 -t 1 seed 5 -o"
+    "climb 300 -t 1 seed 7 -o target 30"
+    "-r climb 300 -t 1 seed 5 -o"
+    "-r climb 300 -t 1 seed 7 -o freeze 3 fund 300"
+    "reorder 300 -t 1 seed 9"
+    "brawl climb 200 -t 1 seed 3 -o endgame 1 fund 500"
+)
+
+declare -i FAILED=0
+for CASE in "${CASES[@]}"; do
+    if cmp -s <("$OLD_TUO" "$YOUR_DECK" "$ENEMY_DECK" $CASE 2>&1) <("$NEW_TUO" "$YOUR_DECK" "$ENEMY_DECK" $CASE 2>&1); then
+        echo "same: $CASE"
+    else
+        echo "DIFFERENT: $CASE"
+        FAILED+=1
+    fi
+done
+exit $FAILED
@@ -15,10 +15,15 @@
 #define BOOST_THREAD_USE_LIB
 #include <cassert>
 #include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <list>
 #include <map>
 #include <set>
 #include <stack>
@@ -26,17 +31,30 @@
 #include <tuple>
 #include <vector>
 #include <boost/algorithm/string.hpp>
+#include <boost/align/aligned_alloc.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/math/distributions/binomial.hpp>
 #include <boost/optional.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
 #include <boost/range/join.hpp>
 #include <boost/thread/barrier.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/tokenizer.hpp>
+#ifndef _WIN32
+#include <boost/asio.hpp>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "card.h"
 #include "cards.h"
+#include "db.h"
 #include "deck.h"
+#include "lockstep.h"
 #include "read.h"
 #include "sim.h"
 #include "tyrant.h"
@@ -47,6 +65,14 @@ struct Requirement
     std::unordered_map<const Card*, unsigned> num_cards;
 };
 
+// A card's recipe expanded down to the cards that have no recipe; built once per run.
+struct RecipeExpansion
+{
+    std::vector<std::pair<const Card*, unsigned>> base_cards;
+    unsigned cost; // SP to make the card from base_cards
+    bool made_in_full; // neither the card nor any card made on the way is owned
+};
+
 namespace {
     gamemode_t gamemode{fight};
     OptimizationMode optimization_mode{OptimizationMode::notset};
@@ -64,6 +90,21 @@ namespace {
     bool show_ci{false};
     bool use_harmonic_mean{false};
     unsigned sim_seed{0};
+    bool use_dominance{false};
+    CardIdSet dominated_cards;
+    unsigned population_size{16};
+    unsigned num_generations{20};
+    unsigned beam_width{4};
+    unsigned long long max_num_orders{20000};
+    bool fork_orders{false};
+    bool use_lockstep{false};
+    bool lockstep_check{false};
+    bool show_early_ends{false};
+    bool show_histograms{false};
+    bool pin_threads{false};
+    std::ofstream json_file;
+    std::chrono::steady_clock::time_point start_time;
+    std::unordered_map<const Card*, RecipeExpansion> recipe_table;
     Requirement requirement;
     Quest quest;
 }
@@ -102,71 +143,202 @@ std::string card_slot_id_names(const std::vector<std::pair<signed, const Card *>
     return ios.str();
 }
 //------------------------------------------------------------------------------
-Deck* find_deck(Decks& decks, const Cards& all_cards, std::string deck_name)
+// Look up or build the deck; return a copy owned by request_decks, so that the loaded decks are never modified.
+Deck* find_deck(Decks& decks, const Cards& all_cards, std::string deck_name, std::list<Deck>& request_decks)
 {
     Deck* deck = decks.find_deck_by_name(deck_name);
     if (deck != nullptr)
     {
         deck->resolve();
-        return(deck);
+        request_decks.push_back(*deck);
+        return(&request_decks.back());
     }
-    decks.decks.emplace_back(Deck{all_cards});
-    deck = &decks.decks.back();
+    request_decks.emplace_back(Deck{all_cards});
+    deck = &request_decks.back();
     deck->set(deck_name);
     deck->resolve();
     return(deck);
 }
 //---------------------- $80 deck optimization ---------------------------------
-unsigned get_required_cards_before_upgrade(const std::vector<const Card *> & card_list, std::map<const Card*, unsigned> & num_cards)
+const RecipeExpansion & expand_recipe(const Card * card)
 {
-    unsigned deck_cost = 0;
-    std::set<const Card*> unresolved_cards;
-    for (const Card * card : card_list)
-    {
-        ++ num_cards[card];
-        unresolved_cards.insert(card);
-    }
-    // un-upgrade only if fund is used
-    while (fund > 0 && !unresolved_cards.empty())
-    {
-        auto card_it = unresolved_cards.end();
-        auto card = *(-- card_it);
-        unresolved_cards.erase(card_it);
-        if ((use_fused_card_level > 0 && card->m_set == 1000 && card->m_rarity <= 2 && card->m_level == 1) ||  // assume unlimited common/rare level-1 cards (standard set) under endgame 1|2
-            (owned_cards[card->m_id] < num_cards[card] && !card->m_recipe_cards.empty()))
-        {
-            unsigned num_under = num_cards[card] - owned_cards[card->m_id];
-            num_cards[card] = owned_cards[card->m_id];
-//            std::cout << "-" << num_under << " " << card->m_name << "\n"; // XXX
-            deck_cost += num_under * card->m_recipe_cost;
-            for (auto recipe_it : card->m_recipe_cards)
-            {
-                num_cards[recipe_it.first] += num_under * recipe_it.second;
-//                std::cout << "+" << num_under * recipe_it.second << " " << recipe_it.first->m_name << "\n"; // XXX
-                unresolved_cards.insert(recipe_it.first);
-            }
+    auto expansion_it = recipe_table.find(card);
+    if (expansion_it != recipe_table.end())
+    { return expansion_it->second; }
+    RecipeExpansion expansion{{}, card->m_recipe_cost, false};
+    std::map<const Card*, unsigned> base_cards;
+    for (const auto & recipe_it: card->m_recipe_cards)
+    {
+        if (recipe_it.first->m_recipe_cards.empty())
+        {
+            base_cards[recipe_it.first] += recipe_it.second;
+            continue;
         }
+        const RecipeExpansion & material = expand_recipe(recipe_it.first);
+        expansion.cost += recipe_it.second * material.cost;
+        for (const auto & base_it: material.base_cards)
+        { base_cards[base_it.first] += recipe_it.second * base_it.second; }
     }
-//    std::cout << "\n"; // XXX
-    return deck_cost;
+    expansion.base_cards.assign(base_cards.begin(), base_cards.end());
+    return recipe_table[card] = expansion;
 }
 
-unsigned get_deck_cost(const Deck * deck)
+bool update_made_in_full(const Card * card, std::unordered_set<const Card*> & updated)
 {
-    if (!use_owned_cards)
-    { return 0; }
-    std::map<const Card *, unsigned> num_in_deck;
-    unsigned deck_cost = get_required_cards_before_upgrade({deck->commander}, num_in_deck);
-    deck_cost += get_required_cards_before_upgrade(deck->cards, num_in_deck);
-    for(auto it: num_in_deck)
+    RecipeExpansion & expansion = recipe_table.at(card);
+    if (updated.insert(card).second)
+    {
+        auto owned_it = owned_cards.find(card->m_id);
+        expansion.made_in_full = owned_it == owned_cards.end() || owned_it->second == 0;
+        for (const auto & recipe_it: card->m_recipe_cards)
+        {
+            if (!recipe_it.first->m_recipe_cards.empty() && !update_made_in_full(recipe_it.first, updated))
+            { expansion.made_in_full = false; }
+        }
+    }
+    return expansion.made_in_full;
+}
+
+// call whenever the owned cards change
+void update_recipe_table()
+{
+    std::unordered_set<const Card*> updated;
+    for (const auto & expansion_it: recipe_table)
+    { update_made_in_full(expansion_it.first, updated); }
+}
+
+// expand the recipes once they are final (after disallow-recipes)
+void build_recipe_table(const Cards & all_cards)
+{
+    recipe_table.clear();
+    for (const Card * card: all_cards.all_cards)
+    {
+        if (!card->m_recipe_cards.empty())
+        { expand_recipe(card); }
+    }
+    update_recipe_table();
+}
+
+// Deck cost kept up to date as single cards are added to or removed from the deck.
+// Each card takes the owned copies first, and the copies it lacks are made from its recipe (if fund is used),
+// so the cost does not depend on the order of the cards.
+class DeckCostModel
+{
+public:
+    explicit DeckCostModel(const std::vector<const Card*> & cards) :
+        deck_cost(0),
+        num_short_cards(0)
+    {
+        for (const Card* card: cards)
+        {
+            add(card);
+        }
+    }
+
+    DeckCostModel(const Card* commander, const std::vector<const Card*> & cards) :
+        DeckCostModel(cards)
+    {
+        add(commander);
+    }
+
+    void add(const Card* card) { change(card, 1); }
+    void remove(const Card* card) { change(card, -1); }
+    void replace(const Card* old_card, const Card* new_card)
+    {
+        remove(old_card);
+        add(new_card);
+    }
+
+    // UINT_MAX if the owned cards cannot make the deck
+    unsigned cost() const
+    {
+        if (!use_owned_cards)
+        { return 0; }
+        return num_short_cards > 0 ? UINT_MAX : deck_cost;
+    }
+
+    // copies of each card taken from the owned cards (or lacking), without the cards made in full
+    std::map<const Card*, unsigned> num_cards_used() const
+    {
+        std::map<const Card*, unsigned> num_cards;
+        for (const auto & count_it: counts)
+        {
+            num_cards[count_it.first] = count_it.second.required - num_to_make(count_it.first, count_it.second);
+        }
+        return num_cards;
+    }
+
+private:
+    struct CardCount
+    {
+        unsigned required;
+        unsigned owned;
+    };
+    std::unordered_map<const Card*, CardCount> counts;
+    unsigned deck_cost;
+    unsigned num_short_cards;
+
+    // copies of the card to be made from its recipe
+    static unsigned num_to_make(const Card* card, const CardCount & count)
+    {
+        if (fund == 0 || count.required <= count.owned)
+        { return 0; }
+        if ((use_fused_card_level > 0 && card->m_set == 1000 && card->m_rarity <= 2 && card->m_level == 1) || !card->m_recipe_cards.empty())
+        { return count.required - count.owned; }
+        return 0;
+    }
+
+    // copies of the card required beyond the owned ones and not made
+    static bool is_short(const Card* card, const CardCount & count)
+    {
+        return count.required - num_to_make(card, count) > count.owned;
+    }
+
+    void change(const Card* card, signed delta)
+    {
+        auto count_it = counts.find(card);
+        if (count_it == counts.end())
+        {
+            auto owned_it = owned_cards.find(card->m_id);
+            count_it = counts.insert({card, {0, owned_it == owned_cards.end() ? 0 : owned_it->second}}).first;
+        }
+        CardCount & count = count_it->second;
+        unsigned old_num_to_make = num_to_make(card, count);
+        num_short_cards -= is_short(card, count);
+        count.required += delta;
+        num_short_cards += is_short(card, count);
+        signed made_delta = (signed)num_to_make(card, count) - (signed)old_num_to_make;
+        if (made_delta == 0)
+        { return; }
+        deck_cost += made_delta * (signed)card->m_recipe_cost;
+        for (const auto & recipe_it: card->m_recipe_cards)
+        {
+            change_material(recipe_it.first, made_delta * (signed)recipe_it.second);
+        }
+    }
+
+    void change_material(const Card* material, signed delta)
     {
-        unsigned card_id = it.first->m_id;
-        if (it.second > owned_cards[card_id])
+        // no copy of the material or of what it is made of is owned: make it from its base cards at once
+        auto expansion_it = recipe_table.find(material);
+        if (expansion_it != recipe_table.end() && expansion_it->second.made_in_full)
         {
-            return UINT_MAX;
+            deck_cost += delta * (signed)expansion_it->second.cost;
+            for (const auto & base_it: expansion_it->second.base_cards)
+            {
+                change(base_it.first, delta * (signed)base_it.second);
+            }
+            return;
         }
+        change(material, delta);
     }
-    return deck_cost;
+};
+
+unsigned get_deck_cost(const Deck * deck)
+{
+    if (!use_owned_cards)
+    { return 0; }
+    return DeckCostModel(deck->commander, deck->cards).cost();
 }
 
 // remove val from oppo if found, otherwise append val to self
@@ -202,17 +374,23 @@ bool adjust_deck(Deck * deck, const signed from_slot, const signed to_slot, cons
     bool is_random = deck->strategy == DeckStrategy::random;
     std::vector<const Card *> cards = deck->cards;
     card = card->m_top_level_card;
+    // cost of the deck being rebuilt; follows every change to deck->commander and deck->cards below
+    DeckCostModel cost_model(deck->commander, {});
     {
         // try to add new card into the deck, unfuse/downgrade it if necessary
         std::stack<const Card *> candidate_cards;
         candidate_cards.emplace(card);
+        deck->cards.clear();
         while (! candidate_cards.empty())
         {
             const Card* card_in = candidate_cards.top();
             candidate_cards.pop();
-            deck->cards.clear();
-            deck->cards.emplace_back(card_in);
-            deck_cost = get_deck_cost(deck);
+            if (deck->cards.empty())
+            { cost_model.add(card_in); }
+            else
+            { cost_model.replace(deck->cards[0], card_in); }
+            deck->cards.assign(1, card_in);
+            deck_cost = cost_model.cost();
             if (use_top_level_card || deck_cost <= fund)
             { break; }
             for (auto recipe_it : card_in->m_recipe_cards)
@@ -233,8 +411,9 @@ bool adjust_deck(Deck * deck, const signed from_slot, const signed to_slot, cons
         {
             const Card* card_in = candidate_cards.top();
             candidate_cards.pop();
+            cost_model.replace(deck->commander, card_in);
             deck->commander = card_in;
-            deck_cost = get_deck_cost(deck);
+            deck_cost = cost_model.cost();
             if (deck_cost <= fund)
             { break; }
             for (auto recipe_it : card_in->m_recipe_cards)
@@ -265,8 +444,12 @@ bool adjust_deck(Deck * deck, const signed from_slot, const signed to_slot, cons
         {
             const Card* card_in = candidate_cards.top();
             candidate_cards.pop();
+            if (*in_it == nullptr)
+            { cost_model.add(card_in); }
+            else
+            { cost_model.replace(*in_it, card_in); }
             *in_it = card_in;
-            deck_cost = get_deck_cost(deck);
+            deck_cost = cost_model.cost();
             if (use_top_level_card || deck_cost <= fund)
             { break; }
             if (i < (signed)freezed_cards)
@@ -277,6 +460,7 @@ bool adjust_deck(Deck * deck, const signed from_slot, const signed to_slot, cons
         if (deck_cost > fund)
         {
             append_unless_remove(cards_out, cards_in, {is_random ? -1 : i + (i >= to_slot), cards[i]});
+            cost_model.remove(*in_it);
             deck->cards = saved_cards;
         }
         else if (*in_it != cards[i])
@@ -285,7 +469,7 @@ bool adjust_deck(Deck * deck, const signed from_slot, const signed to_slot, cons
             append_unless_remove(cards_in, cards_out, {is_random ? -1 : i + (i >= to_slot), *in_it});
         }
     }
-    deck_cost = get_deck_cost(deck);
+    deck_cost = cost_model.cost();
     return !cards_in.empty() || !cards_out.empty();
 }
 
@@ -364,9 +548,8 @@ unsigned check_requirement(const Deck* deck, const Requirement & requirement, co
 
 void claim_cards(const std::vector<const Card*> & card_list)
 {
-    std::map<const Card *, unsigned> num_cards;
-    get_required_cards_before_upgrade(card_list, num_cards);
-    for(const auto & it: num_cards)
+    DeckCostModel cost_model(card_list);
+    for(const auto & it: cost_model.num_cards_used())
     {
         const Card * card = it.first;
         unsigned num_to_claim = safe_minus(it.second, owned_cards[card->m_id]);
@@ -379,6 +562,7 @@ void claim_cards(const std::vector<const Card*> & card_list)
             }
         }
     }
+    update_recipe_table();
 }
 
 //------------------------------------------------------------------------------
@@ -431,10 +615,23 @@ volatile const FinalResults<long double> *thread_best_results{nullptr};
 volatile bool thread_compare{false};
 volatile bool thread_compare_stop{false}; // written by threads
 volatile bool destroy_threads;
+// Batch of decks evaluated together, e.g. a whole population of the genetic search.
+struct BatchItem
+{
+    const Deck* deck;
+    EvaluatedResults* results;
+    unsigned num_iterations; // remaining
+};
+std::vector<BatchItem> thread_batch; // written by threads
+unsigned thread_batch_next{0}; // written by threads
+bool thread_batch_forked{false}; // the decks of the batch play the same battles, forked where they differ
+const unsigned max_claimed_iterations{256}; // the most iterations a thread takes at once outside batches and comparisons
 //------------------------------------------------------------------------------
 // Per thread data.
 // seed should be unique for each thread.
 // d1 and d2 are intended to point to read-only process-wide data.
+// Built by its own thread on pages of its own (see Process::make_thread_data()).
+const size_t simulation_data_alignment{4096};
 struct SimulationData
 {
     std::mt19937 re;
@@ -447,11 +644,34 @@ struct SimulationData
     std::vector<long double> factors;
     gamemode_t gamemode;
     Quest quest;
-    std::unordered_map<unsigned, unsigned> bg_effects;
+    const ScoreTable& score_table;
+    BGEffects bg_effects;
     std::vector<SkillSpec> your_bg_skills, enemy_bg_skills;
+    PlayFunction play_battle;
+    BattleSteps battle;
+    std::vector<std::shared_ptr<Deck>> batch_decks;
+    std::shared_ptr<Deck> fork_deck; // plays the decks of a forked batch, tracking the positions of its cards
+    std::vector<Field::Snapshot> fork_snapshots;
+    std::vector<unsigned> fork_level_snapshot; // prefix -> index in fork_snapshots
+    std::unique_ptr<LockstepBattles> lockstep; // with +lockstep when no BGE or quest rules out every battle
+    // battles played, and those of them ended early by outcome_decided() with the turns they saved
+    unsigned long long num_battles{0};
+    unsigned long long num_early_ends{0};
+    unsigned long long num_turns_saved{0};
+    // By your deck: the results of the battles against each enemy deck that drew no random number, neither to shuffle
+    // the decks nor in play(). Every battle of the two decks ends the same, so evaluate() reuses the result instead.
+    struct FixedResults
+    {
+        std::vector<Results<uint64_t>> results;
+        std::vector<bool> known;
+        unsigned num_known{0};
+    };
+    std::unordered_map<const Deck*, FixedResults> fixed_results;
+    // with +hist: the number of battles of each score against each enemy deck, since set_decks()
+    std::vector<std::map<uint64_t, uint64_t>> points_histograms;
 
     SimulationData(unsigned seed, const Cards& cards_, const Decks& decks_, unsigned num_enemy_decks_, std::vector<long double> factors_, gamemode_t gamemode_, Quest & quest_,
-            std::unordered_map<unsigned, unsigned>& bg_effects_, std::vector<SkillSpec>& your_bg_skills_, std::vector<SkillSpec>& enemy_bg_skills_) :
+            const ScoreTable& score_table_, std::unordered_map<unsigned, unsigned>& bg_effects_, std::vector<SkillSpec>& your_bg_skills_, std::vector<SkillSpec>& enemy_bg_skills_) :
         re(seed),
         cards(cards_),
         decks(decks_),
@@ -461,14 +681,22 @@ struct SimulationData
         factors(factors_),
         gamemode(gamemode_),
         quest(quest_),
+        score_table(score_table_),
         bg_effects(bg_effects_),
         your_bg_skills(your_bg_skills_),
-        enemy_bg_skills(enemy_bg_skills_)
+        enemy_bg_skills(enemy_bg_skills_),
+        play_battle(play_function(bg_effects.any(), optimization_mode == OptimizationMode::quest)),
+        battle(battle_steps(bg_effects.any(), optimization_mode == OptimizationMode::quest))
     {
         for (size_t i = 0; i < num_enemy_decks_; ++i)
         {
             enemy_hands.emplace_back(new Hand(nullptr));
         }
+        if (use_lockstep && !bg_effects.any() && your_bg_skills.empty() && enemy_bg_skills.empty() && optimization_mode != OptimizationMode::quest)
+        {
+            lockstep.reset(new LockstepBattles(re, cards, gamemode, optimization_mode, quest, score_table, bg_effects, your_bg_skills, enemy_bg_skills, play_battle));
+            lockstep->check = lockstep_check;
+        }
     }
 
     ~SimulationData()
@@ -485,28 +713,186 @@ struct SimulationData
             enemy_decks[i].reset(enemy_decks_[i]->clone());
             enemy_hands[i]->deck = enemy_decks[i].get();
         }
+        if (lockstep)
+        {
+            lockstep->set_decks(your_deck_, enemy_decks_);
+        }
+        fixed_results.clear();
+        points_histograms.assign(enemy_decks.size(), {});
+    }
+
+    // The results of an iteration of deck if evaluate() found every battle of it fixed, otherwise nullptr.
+    const std::vector<Results<uint64_t>>* fixed_results_of(const Deck* deck) const
+    {
+        if (deck->shuffle_draws()) { return nullptr; }
+        auto it = fixed_results.find(deck);
+        return(it != fixed_results.end() && it->second.num_known == enemy_hands.size() ? &it->second.results : nullptr);
+    }
+
+    // True if the lanes of +lockstep play the iterations of deck. The lanes do not tell fixed battles, so the battles of decks
+    // that no shuffle draws a random number for are left to evaluate() until it has found them not all fixed.
+    bool use_lanes(const Deck* deck) const
+    {
+        if (!lockstep) { return false; }
+        if (deck->shuffle_draws() || std::any_of(enemy_decks.begin(), enemy_decks.end(),
+                    [](const std::shared_ptr<Deck>& enemy_deck) { return enemy_deck->shuffle_draws(); }))
+        {
+            return true;
+        }
+        return(fixed_results.count(deck) > 0 && !fixed_results_of(deck));
+    }
+
+    void set_batch_decks(const std::vector<BatchItem> & batch)
+    {
+        batch_decks.clear();
+        for (const auto & item: batch)
+        {
+            batch_decks.emplace_back(item.deck->clone());
+        }
+        if (thread_batch_forked)
+        {
+            fork_deck.reset(batch.front().deck->clone());
+            fork_deck->track_positions = true;
+        }
+    }
+
+    void count_battle(const Field& fd)
+    {
+        ++ num_battles;
+        num_early_ends += fd.turns_saved > 0;
+        num_turns_saved += fd.turns_saved;
     }
 
     inline std::vector<Results<uint64_t>> evaluate()
     {
         std::vector<Results<uint64_t>> res;
-        for(Hand* enemy_hand: enemy_hands)
+        FixedResults* fixed = nullptr;
+        if (!your_hand.deck->shuffle_draws())
+        {
+            fixed = &fixed_results[your_hand.deck];
+            fixed->results.resize(enemy_hands.size());
+            fixed->known.resize(enemy_hands.size(), false);
+        }
+        for(unsigned i = 0; i < enemy_hands.size(); ++i)
         {
+            if (fixed && fixed->known[i])
+            {
+                res.emplace_back(fixed->results[i]);
+                continue;
+            }
+            Hand* enemy_hand = enemy_hands[i];
             your_hand.reset(re);
             enemy_hand->reset(re);
-            Field fd(re, cards, your_hand, *enemy_hand, gamemode, optimization_mode, quest, bg_effects, your_bg_skills, enemy_bg_skills);
-            Results<uint64_t> result(play(&fd));
+            Field fd(re, cards, your_hand, *enemy_hand, gamemode, optimization_mode, quest, score_table, bg_effects, your_bg_skills, enemy_bg_skills);
+            Results<uint64_t> result(play_battle(&fd));
+            count_battle(fd);
+            if (fixed && fd.num_draws == 0 && !enemy_hand->deck->shuffle_draws())
+            {
+                fixed->results[i] = result;
+                fixed->known[i] = true;
+                ++ fixed->num_known;
+            }
             res.emplace_back(result);
         }
         return(res);
     }
+
+    // Plays one battle per enemy deck for each batch deck of indices, all from the same random state.
+    // The decks differ only in the order of their cards: the battle of a deck is continued from the state
+    // saved by an earlier deck at the first turn drawing from where the two differ, or reused if there is none.
+    // Sorting the decks by their cards makes the shared prefixes long.
+    std::vector<std::vector<Results<uint64_t>>> evaluate_forked(const std::vector<unsigned> & indices)
+    {
+        const unsigned num_decks = indices.size();
+        const unsigned deck_size = fork_deck->cards.size();
+        // Deck i shares fork_prefix[i] cards with deck i - 1 and forks from the latest deck before it that shares fewer;
+        // fork_levels[fork_levels_begin[k]...] lists the prefixes that deck k saves the state for, in ascending order.
+        std::vector<unsigned> fork_prefix(num_decks, 0);
+        std::vector<unsigned> fork_levels_begin(num_decks + 1, 0);
+        std::vector<unsigned> fork_source(num_decks, 0);
+        std::vector<unsigned> sources{0};
+        for(unsigned i = 1; i < num_decks; ++i)
+        {
+            const auto & deck_cards = batch_decks[indices[i]]->cards;
+            const auto & prev_cards = batch_decks[indices[i - 1]]->cards;
+            fork_prefix[i] = std::mismatch(deck_cards.begin(), deck_cards.end(), prev_cards.begin()).first - deck_cards.begin();
+            while (sources.size() > 1 && fork_prefix[sources.back()] >= fork_prefix[i]) { sources.pop_back(); }
+            fork_source[i] = sources.back();
+            sources.push_back(i);
+            ++ fork_levels_begin[fork_source[i] + 1];
+        }
+        std::partial_sum(fork_levels_begin.begin(), fork_levels_begin.end(), fork_levels_begin.begin());
+        std::vector<unsigned> fork_levels(num_decks);
+        std::vector<unsigned> fill(fork_levels_begin.begin(), fork_levels_begin.end() - 1);
+        for(unsigned i = num_decks; i-- > 1; )
+        {
+            fork_levels[fill[fork_source[i]] ++] = fork_prefix[i];
+        }
+
+        std::vector<std::vector<Results<uint64_t>>> res(num_decks);
+        fork_level_snapshot.resize(deck_size);
+        your_hand.deck = fork_deck.get();
+        for(Hand* enemy_hand: enemy_hands)
+        {
+            Field fd(re, cards, your_hand, *enemy_hand, gamemode, optimization_mode, quest, score_table, bg_effects, your_bg_skills, enemy_bg_skills);
+            unsigned num_levels = 0; // the battle has drawn from the first num_levels cards
+            unsigned num_snapshots = 0;
+            Results<uint64_t> result{0, 0, 0, 0};
+            for(unsigned i = 0; i < num_decks; ++i)
+            {
+                const auto & deck_cards = batch_decks[indices[i]]->cards;
+                const unsigned prefix = fork_prefix[i];
+                if (i == 0)
+                {
+                    fork_deck->cards = deck_cards;
+                    your_hand.reset(re);
+                    enemy_hand->reset(re);
+                    battle.start(&fd);
+                }
+                else if (prefix >= num_levels)
+                {
+                    // the battle never drew from prefix on: it is the same with this deck
+                    res[i].push_back(result);
+                    continue;
+                }
+                else
+                {
+                    num_levels = prefix + 1;
+                    num_snapshots = fork_level_snapshot[prefix] + 1;
+                    fd.restore(fork_snapshots[num_snapshots - 1]);
+                    fork_deck->replace_suffix(deck_cards, prefix);
+                }
+                auto level = fork_levels.begin() + fork_levels_begin[i];
+                const auto levels_end = fork_levels.begin() + fork_levels_begin[i + 1];
+                while (!fd.over())
+                {
+                    if (fd.tapi == 0 && num_levels < deck_size)
+                    {
+                        unsigned reach = fork_deck->draw_reach();
+                        if (level != levels_end && *level < reach)
+                        {
+                            if (fork_snapshots.size() <= num_snapshots) { fork_snapshots.emplace_back(); }
+                            fd.save(fork_snapshots[num_snapshots]);
+                            for (; level != levels_end && *level < reach; ++ level) { fork_level_snapshot[*level] = num_snapshots; }
+                            ++ num_snapshots;
+                        }
+                        num_levels = std::max(num_levels, reach);
+                    }
+                    battle.play_turn(&fd);
+                }
+                result = battle.result(&fd);
+                count_battle(fd);
+                res[i].push_back(result);
+            }
+        }
+        return(res);
+    }
 };
 //------------------------------------------------------------------------------
 class Process;
 void thread_evaluate(boost::barrier& main_barrier,
                      boost::mutex& shared_mutex,
-                     SimulationData& sim,
-                     const Process& p,
+                     Process& p,
                      unsigned thread_id);
 //------------------------------------------------------------------------------
 class Process
@@ -524,8 +910,10 @@ public:
     std::vector<long double> factors;
     gamemode_t gamemode;
     Quest quest;
+    ScoreTable score_table;
     std::unordered_map<unsigned, unsigned> bg_effects;
     std::vector<SkillSpec> your_bg_skills, enemy_bg_skills;
+    unsigned seed;
 
     Process(unsigned num_threads_, const Cards& cards_, const Decks& decks_, Deck* your_deck_, std::vector<Deck*> enemy_decks_, std::vector<long double> factors_, gamemode_t gamemode_, Quest & quest_,
             std::unordered_map<unsigned, unsigned>& bg_effects_, std::vector<SkillSpec>& your_bg_skills_, std::vector<SkillSpec>& enemy_bg_skills_) :
@@ -538,21 +926,25 @@ public:
         factors(factors_),
         gamemode(gamemode_),
         quest(quest_),
+        score_table(optimization_mode, quest),
         bg_effects(bg_effects_),
         your_bg_skills(your_bg_skills_),
         enemy_bg_skills(enemy_bg_skills_)
     {
         destroy_threads = false;
-        unsigned seed(sim_seed ? sim_seed : std::chrono::system_clock::now().time_since_epoch().count() * 2654435761);  // Knuth multiplicative hash
+        seed = sim_seed ? sim_seed : std::chrono::system_clock::now().time_since_epoch().count() * 2654435761;  // Knuth multiplicative hash
         if (num_threads_ == 1)
         {
             std::cout << "RNG seed " << seed << std::endl;
         }
+        // each thread makes its data, then waits at main_barrier: wait for all of them,
+        // so that threads_data is complete once the Process is constructed
+        threads_data.resize(num_threads, nullptr);
         for(unsigned i(0); i < num_threads; ++i)
         {
-            threads_data.push_back(new SimulationData(seed + i, cards, decks, enemy_decks.size(), factors, gamemode, quest, bg_effects, your_bg_skills, enemy_bg_skills));
-            threads.push_back(new boost::thread(thread_evaluate, std::ref(main_barrier), std::ref(shared_mutex), std::ref(*threads_data.back()), std::ref(*this), i));
+            threads.push_back(new boost::thread(thread_evaluate, std::ref(main_barrier), std::ref(shared_mutex), std::ref(*this), i));
         }
+        main_barrier.wait();
     }
 
     ~Process()
@@ -560,7 +952,22 @@ public:
         destroy_threads = true;
         main_barrier.wait();
         for(auto thread: threads) { thread->join(); }
-        for(auto data: threads_data) { delete(data); }
+        for(auto data: threads_data)
+        {
+            data->~SimulationData();
+            boost::alignment::aligned_free(data);
+        }
+    }
+
+    // Called by thread thread_id: its data is allocated and first touched by the thread that uses it, which places the pages
+    // on the thread's NUMA node, and starts on a page of its own, so that no two threads write to the same cache line.
+    SimulationData& make_thread_data(unsigned thread_id)
+    {
+        void* memory = boost::alignment::aligned_alloc(simulation_data_alignment, sizeof(SimulationData));
+        if (memory == nullptr) { throw std::bad_alloc(); }
+        threads_data[thread_id] = new(memory) SimulationData(seed + thread_id, cards, decks, enemy_decks.size(), factors, gamemode, quest, score_table,
+                bg_effects, your_bg_skills, enemy_bg_skills);
+        return *threads_data[thread_id];
     }
 
     EvaluatedResults & evaluate(unsigned num_iterations, EvaluatedResults & evaluated_results)
@@ -596,49 +1003,285 @@ public:
         main_barrier.wait();
         return evaluated_results;
     }
+
+    void print_lockstep_check() const
+    {
+        unsigned long long num_lockstep_battles = 0, num_scalar_battles = 0, num_mismatches = 0;
+        for (const auto data: threads_data)
+        {
+            if (!data->lockstep) { continue; }
+            num_lockstep_battles += data->lockstep->num_lockstep_battles;
+            num_scalar_battles += data->lockstep->num_scalar_battles;
+            num_mismatches += data->lockstep->num_mismatches;
+        }
+        std::cout << "lockstep: " << num_lockstep_battles << " battles in lanes (" << num_mismatches << " mismatched on replay), "
+            << num_scalar_battles << " battles played as usual" << std::endl;
+    }
+
+    void print_early_ends() const
+    {
+        unsigned long long num_battles = 0, num_early_ends = 0, num_turns_saved = 0;
+        for (const auto data: threads_data)
+        {
+            num_battles += data->num_battles;
+            num_early_ends += data->num_early_ends;
+            num_turns_saved += data->num_turns_saved;
+            if (data->lockstep)
+            {
+                num_battles += data->lockstep->num_lockstep_battles + data->lockstep->num_scalar_battles;
+                num_early_ends += data->lockstep->num_early_ends;
+                num_turns_saved += data->lockstep->num_turns_saved;
+            }
+        }
+        std::cout << "early end: " << num_early_ends << " of " << num_battles << " battles, " << num_turns_saved << " turns saved" << std::endl;
+    }
+
+    void print_histograms() const
+    {
+        for (unsigned index = 0; index < enemy_decks.size(); ++ index)
+        {
+            std::map<uint64_t, uint64_t> histogram;
+            for (const auto data: threads_data)
+            {
+                for (const auto & bin: data->points_histograms[index]) { histogram[bin.first] += bin.second; }
+            }
+            uint64_t num_battles = 0;
+            long double sum = 0, sum_squares = 0;
+            for (const auto & bin: histogram)
+            {
+                num_battles += bin.second;
+                sum += (long double)bin.first * bin.second;
+                sum_squares += (long double)bin.first * bin.first * bin.second;
+            }
+            if (num_battles == 0) { continue; }
+            long double mean = sum / num_battles;
+            long double deviation = std::sqrt(std::max<long double>(0, sum_squares / num_battles - mean * mean));
+            // the least points that at least the fraction q of the battles do not exceed
+            auto percentile = [&histogram, num_battles](long double q) {
+                uint64_t count = 0;
+                for (const auto & bin: histogram)
+                {
+                    count += bin.second;
+                    if (count >= q * num_battles) { return bin.first; }
+                }
+                return histogram.rbegin()->first;
+            };
+            const Deck* enemy_deck = enemy_decks[index];
+            std::cout << "hist vs " << (enemy_deck->name.empty() ? enemy_deck->hash() : enemy_deck->name) << ": " << num_battles << " battles"
+                << ", mean " << mean << ", sd " << deviation << ", min " << histogram.begin()->first << ", 10% " << percentile(.1)
+                << ", median " << percentile(.5) << ", 90% " << percentile(.9) << ", max " << histogram.rbegin()->first << std::endl;
+            for (const auto & bin: histogram)
+            {
+                std::cout << "  " << bin.first << ": " << bin.second << " (" << bin.second * 100.0 / num_battles << "%)" << std::endl;
+            }
+        }
+    }
+
+    // Evaluate every deck of the batch up to num_iterations simulations, spreading the work of all decks over all threads.
+    // forked: the decks differ only in their order and play the same battles (see SimulationData::evaluate_forked).
+    void evaluate_batch(unsigned num_iterations, const std::vector<std::pair<const Deck*, EvaluatedResults*>> & batch, bool forked = false)
+    {
+        thread_batch.clear();
+        thread_num_iterations = 0;
+        for (const auto & item: batch)
+        {
+            if (num_iterations > item.second->second)
+            {
+                thread_batch.push_back({item.first, item.second, num_iterations - item.second->second});
+                // a forked battle serves every deck of the batch at once
+                thread_num_iterations = forked ? std::max<unsigned>((unsigned)thread_num_iterations, thread_batch.back().num_iterations)
+                    : thread_num_iterations + thread_batch.back().num_iterations;
+            }
+        }
+        if (thread_batch.empty())
+        {
+            return;
+        }
+        thread_batch_next = 0;
+        thread_batch_forked = forked;
+        thread_results = nullptr;
+        thread_compare = false;
+        // unlock all the threads
+        main_barrier.wait();
+        // wait for the threads
+        main_barrier.wait();
+        thread_batch.clear();
+        thread_batch_forked = false;
+    }
 };
 //------------------------------------------------------------------------------
+// Keeps the calling thread on CPU thread_id (modulo the number of CPUs); false if it cannot.
+bool pin_thread(unsigned thread_id)
+{
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(thread_id % std::max(1u, boost::thread::hardware_concurrency()), &cpus);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+    (void)thread_id;
+    return false;
+#endif
+}
+//------------------------------------------------------------------------------
 void thread_evaluate(boost::barrier& main_barrier,
                      boost::mutex& shared_mutex,
-                     SimulationData& sim,
-                     const Process& p,
+                     Process& p,
                      unsigned thread_id)
 {
+    if (pin_threads && !pin_thread(thread_id) && thread_id == 0)
+    {
+        std::cerr << "Warning: +pin: cannot pin the threads to CPUs on this system." << std::endl;
+    }
+    SimulationData& sim = p.make_thread_data(thread_id);
+    // let the constructor of p return
+    main_barrier.wait();
     while(true)
     {
         main_barrier.wait();
         sim.set_decks(p.your_deck, p.enemy_decks);
         if(destroy_threads)
         { return; }
+        sim.set_batch_decks(thread_batch);
         while(true)
         {
             shared_mutex.lock(); //<<<<
             if(thread_num_iterations == 0 || (thread_compare && thread_compare_stop)) //!
             {
                 shared_mutex.unlock(); //>>>>
+                sim.your_hand.deck = sim.your_deck.get();
                 main_barrier.wait();
                 break;
             }
             else
             {
-                --thread_num_iterations; //!
+                // lanes play several iterations at once, outside batches
+                const bool use_lanes = thread_batch.empty() && sim.use_lanes(sim.your_deck.get());
+                unsigned num_lanes = use_lanes ? std::min<unsigned>(lockstep_width, (unsigned)thread_num_iterations) : 1; //!
+                // outside batches and comparisons, take a share of the iterations left at once (a multiple of num_lanes),
+                // so that the threads meet at the lock and the shared results once per share rather than once per battle
+                unsigned num_claimed = num_lanes;
+                if (thread_batch.empty() && !thread_compare)
+                {
+                    num_claimed = std::max(num_lanes, std::min<unsigned>(thread_num_iterations / (8 * p.num_threads), max_claimed_iterations) / num_lanes * num_lanes); //!
+                }
+                thread_num_iterations -= num_claimed; //!
+                if (thread_batch_forked)
+                {
+                    // one battle for each deck still short of simulations
+                    std::vector<unsigned> indices;
+                    for (unsigned i = 0; i < thread_batch.size(); ++i)
+                    {
+                        if (thread_batch[i].num_iterations > 0) //!
+                        {
+                            -- thread_batch[i].num_iterations; //!
+                            indices.push_back(i);
+                        }
+                    }
+                    shared_mutex.unlock(); //>>>>
+                    auto forked_results = sim.evaluate_forked(indices);
+                    shared_mutex.lock(); //<<<<
+                    for (unsigned j = 0; j < indices.size(); ++j)
+                    {
+                        EvaluatedResults* results = thread_batch[indices[j]].results;
+                        for (unsigned index(0); index < forked_results[j].size(); ++index)
+                        {
+                            results->first[index] += forked_results[j][index]; //!
+                        }
+                        ++results->second; //!
+                    }
+                    shared_mutex.unlock(); //>>>>
+                    continue;
+                }
+                EvaluatedResults* results = thread_results;
+                if (!thread_batch.empty())
+                {
+                    // take the decks of the batch in turn
+                    while (thread_batch[thread_batch_next].num_iterations == 0) //!
+                    {
+                        thread_batch_next = (thread_batch_next + 1) % thread_batch.size(); //!
+                    }
+                    -- thread_batch[thread_batch_next].num_iterations; //!
+                    results = thread_batch[thread_batch_next].results; //!
+                    sim.your_hand.deck = sim.batch_decks[thread_batch_next].get(); //!
+                }
+                // every battle of the deck ends as before: take all the iterations left for it at once
+                const std::vector<Results<uint64_t>>* fixed = sim.fixed_results_of(sim.your_hand.deck);
+                unsigned num_reused = 0;
+                if (fixed)
+                {
+                    if (!thread_batch.empty())
+                    {
+                        num_reused = thread_batch[thread_batch_next].num_iterations; //!
+                        thread_batch[thread_batch_next].num_iterations = 0; //!
+                    }
+                    else
+                    {
+                        num_reused = thread_num_iterations; //!
+                    }
+                    thread_num_iterations -= num_reused; //!
+                    num_reused += num_claimed - 1;  // and the rest of the share claimed above
+                }
+                if (!thread_batch.empty())
+                {
+                    thread_batch_next = (thread_batch_next + 1) % thread_batch.size(); //!
+                }
                 shared_mutex.unlock(); //>>>>
-                std::vector<Results<uint64_t>> result{sim.evaluate()};
+                std::vector<std::vector<Results<uint64_t>>> lane_results;
+                if (fixed)
+                {
+                    lane_results.emplace_back(*fixed);
+                }
+                else
+                {
+                    for (unsigned num_played = 0; num_played < num_claimed; num_played += num_lanes)
+                    {
+                        if (use_lanes)
+                        {
+                            for (auto & iteration_results: sim.lockstep->evaluate(num_lanes))
+                            { lane_results.emplace_back(std::move(iteration_results)); }
+                        }
+                        else
+                        {
+                            lane_results.emplace_back(sim.evaluate());
+                        }
+                    }
+                }
+                // sum the share here, to hold the lock only to add it
+                const unsigned num_enemy_decks = sim.enemy_hands.size();
+                std::vector<Results<uint64_t>> share_results(num_enemy_decks, Results<uint64_t>{0, 0, 0, 0});
+                for (const auto & iteration_results: lane_results)
+                {
+                    for(unsigned index(0); index < num_enemy_decks; ++index)
+                    {
+                        share_results[index] += iteration_results[index];
+                        if (show_histograms && thread_batch.empty()) { ++ sim.points_histograms[index][iteration_results[index].points]; }
+                    }
+                }
+                if (num_reused > 0)
+                {
+                    for(unsigned index(0); index < num_enemy_decks; ++index)
+                    {
+                        const auto & r = lane_results.front()[index];
+                        share_results[index] += Results<uint64_t>{r.wins * num_reused, r.draws * num_reused, r.losses * num_reused, r.points * num_reused};
+                        if (show_histograms && thread_batch.empty()) { sim.points_histograms[index][r.points] += num_reused; }
+                    }
+                }
                 shared_mutex.lock(); //<<<<
-                std::vector<uint64_t> thread_score_local(thread_results->first.size(), 0u); //!
-                for(unsigned index(0); index < result.size(); ++index)
+                std::vector<uint64_t> thread_score_local(num_enemy_decks, 0u); //!
+                for(unsigned index(0); index < num_enemy_decks; ++index)
                 {
-                    thread_results->first[index] += result[index]; //!
-                    thread_score_local[index] = thread_results->first[index].points; //!
+                    results->first[index] += share_results[index]; //!
+                    thread_score_local[index] = results->first[index].points; //!
                 }
-                ++thread_results->second; //!
-                unsigned thread_total_local{thread_results->second}; //!
+                results->second += lane_results.size() + num_reused; //!
+                unsigned thread_total_local{results->second}; //!
                 shared_mutex.unlock(); //>>>>
                 if(thread_compare && thread_id == 0 && thread_total_local > 1)
                 {
                     unsigned score_accum = 0;
                     // Multiple defense decks case: scaling by factors and approximation of a "discrete" number of events.
-                    if(result.size() > 1)
+                    if(num_enemy_decks > 1)
                     {
                         long double score_accum_d = 0.0;
                         for(unsigned i = 0; i < thread_score_local.size(); ++i)
@@ -816,175 +1459,136 @@ void print_deck_inline(const unsigned deck_cost, const FinalResults<long double>
     std::cout << std::endl;
 }
 //------------------------------------------------------------------------------
-void hill_climbing(unsigned num_min_iterations, unsigned num_iterations, Deck* d1, Process& proc, Requirement & requirement, Quest & quest)
+// Append one JSON-lines record about an evaluated deck to the json file (if any), e.g.
+// {"type": "improved", "deck": "<hash>", "score": 63.2, ..., "enemies": [{"wins": 300, ...}], "elapsed": 1.25}
+void print_json_record(const char* type, Deck* deck, const EvaluatedResults& results, std::vector<long double>& factors)
 {
-	EvaluatedResults zero_results = { EvaluatedResults::first_type(proc.enemy_decks.size()), 0 };
-    auto best_deck = d1->hash();
-    std::map<std::string, EvaluatedResults> evaluated_decks{{best_deck, zero_results}};
-    EvaluatedResults & results = proc.evaluate(num_min_iterations, evaluated_decks.begin()->second);
-    print_score_info(results, proc.factors);
-    auto current_score = compute_score(results, proc.factors);
-	auto best_score = current_score;
-    // Non-commander cards
-    auto non_commander_cards = proc.cards.player_assaults;
-    non_commander_cards.insert(non_commander_cards.end(), proc.cards.player_structures.begin(), proc.cards.player_structures.end());
-    non_commander_cards.insert(non_commander_cards.end(), std::initializer_list<Card*>{NULL,});
-    const Card* best_commander = d1->commander;
-    std::vector<const Card*> best_cards = d1->cards;
-    unsigned deck_cost = get_deck_cost(d1);
-    fund = std::max(fund, deck_cost);
-    print_deck_inline(deck_cost, best_score, d1);
-    std::mt19937 & re = proc.threads_data[0]->re;
-    unsigned best_gap = check_requirement(d1, requirement, quest);
-    bool deck_has_been_improved = true;
-    unsigned long skipped_simulations = 0;
-    std::vector<std::pair<signed, const Card *>> cards_out, cards_in;
-    for(unsigned slot_i(0), dead_slot(0); ; slot_i = (slot_i + 1) % std::min<unsigned>(max_deck_len, best_cards.size() + 1))
+    if (!json_file.is_open())
     {
-        if (deck_has_been_improved)
-        {
-            dead_slot = slot_i;
-            deck_has_been_improved = false;
-        }
-        else if (slot_i == dead_slot || best_score.points - target_score > -1e-9)
-        {
-            if (best_score.n_sims >= num_iterations || best_gap > 0)
-            {
-                break;
-            }
-            auto & prev_results = evaluated_decks[best_deck];
-            skipped_simulations += prev_results.second;
-            // Re-evaluate the best deck
-            auto evaluate_result = proc.evaluate(std::min(prev_results.second * 10, num_iterations), prev_results);
-            best_score = compute_score(evaluate_result, proc.factors);
-            std::cout << "Results refined: ";
-            print_score_info(evaluate_result, proc.factors);
-            dead_slot = slot_i;
-        }
-        if (best_score.points - target_score > -1e-9)
-        {
-            continue;
-        }
-        if (requirement.num_cards.count(best_commander) == 0)
+        return;
+    }
+    auto final = compute_score(results, factors);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    json_file << "{\"type\": \"" << type << "\", \"deck\": \"" << deck->hash() << "\""
+        << ", \"score\": " << final.points << ", \"lower_bound\": " << final.points_lower_bound << ", \"upper_bound\": " << final.points_upper_bound
+        << ", \"win\": " << final.wins << ", \"stall\": " << final.draws << ", \"loss\": " << final.losses
+        << ", \"n_sims\": " << results.second << ", \"enemies\": [";
+    for (size_t i = 0; i < results.first.size(); ++ i)
+    {
+        const auto & val = results.first[i];
+        json_file << (i > 0 ? ", " : "") << "{\"wins\": " << val.wins << ", \"draws\": " << val.draws << ", \"losses\": " << val.losses << ", \"points\": " << val.points << "}";
+    }
+    json_file << "], \"elapsed\": " << elapsed.count() << "}" << std::endl;
+}
+//------------------------------------------------------------------------------
+bool is_candidate_allowed(const Deck* deck, const Card* card)
+{
+    if ((card->m_fusion_level < use_fused_card_level || (use_top_level_card && card->m_level < card->m_top_level_card->m_level))
+            && ! deck->allowed_candidates.count(card->m_id))
+    { return false; }
+    return ! deck->disallowed_candidates.count(card->m_id) && ! dominated_cards.count(card->m_id);
+}
+//------------------------------------------------------------------------------
+// whether card b is at least as good as card a in every respect
+bool dominates(const Card* b, const Card* a)
+{
+    if (b->m_type != a->m_type || b->m_faction != a->m_faction ||
+            b->m_attack < a->m_attack || b->m_health < a->m_health || b->m_delay > a->m_delay)
+    { return false; }
+    for (const auto & sa: a->m_skills)
+    {
+        if (std::none_of(b->m_skills.begin(), b->m_skills.end(), [&sa](const SkillSpec & sb)
+                { return sb.id == sa.id && sb.y == sa.y && sb.s == sa.s && sb.s2 == sa.s2 && sb.all == sa.all &&
+                    sb.x >= sa.x && sb.n >= sa.n && sb.c <= sa.c; }))
+        { return false; }
+    }
+    return true;
+}
+
+// whether card b can take the place of every copy of card a a deck may contain
+bool can_replace(const Card* b, const Card* a)
+{
+    if (!use_owned_cards)
+    { return true; }
+    // with fund, a may also be built from lower level cards
+    return owned_cards[b->m_id] >= (fund > 0 ? max_deck_len : std::min(max_deck_len, owned_cards[a->m_id]));
+}
+
+// Collect the candidates that are dominated by another available candidate, so that climbing never simulates them.
+// Must be called after the owned cards are loaded.
+void build_dominance_index(const Deck* deck, const Cards& cards, const Requirement & requirement, const Quest & quest)
+{
+    dominated_cards.clear();
+    std::vector<const Card*> candidates;
+    for (const Card* card: boost::range::join(cards.player_assaults, cards.player_structures))
+    {
+        if (is_candidate_allowed(deck, card))
+        { candidates.emplace_back(card); }
+    }
+    for (const Card* a: candidates)
+    {
+        // the cards already in the deck stay movable
+        if (std::find(deck->cards.begin(), deck->cards.end(), a) != deck->cards.end() ||
+                requirement.num_cards.count(a) || deck->vip_cards.count(a->m_id) ||
+                (quest.quest_type == QuestType::card_survival && quest.quest_key == a->m_id) ||
+                (quest.quest_type == QuestType::skill_use && quest.quest_2nd_key == a->m_id))
+        { continue; }
+        for (const Card* b: candidates)
         {
-            for(const Card* commander_candidate: proc.cards.player_commanders)
+            // of two equivalent cards, keep the one with the lower id
+            if (b != a && dominates(b, a) && can_replace(b, a) && !(a->m_id < b->m_id && dominates(a, b) && can_replace(a, b)))
             {
-                // Various checks to check if the card is accepted
-                assert(commander_candidate->m_type == CardType::commander);
-                if (commander_candidate->m_name == best_commander->m_name)
-                { continue; }
-                d1->cards = best_cards;
-                // Place it in the deck and restore other cards
-                cards_out.clear();
-                cards_out.emplace_back(-1, best_commander);
-                cards_out = {{-1, best_commander}};
-                d1->commander = commander_candidate;
-                if (! adjust_deck(d1, -1, -1, nullptr, fund, re, deck_cost, cards_out, cards_in))
-                { continue; }
-                unsigned new_gap = check_requirement(d1, requirement, quest);
-                if (new_gap > 0 && new_gap >= best_gap)
-                { continue; }
-                auto && cur_deck = d1->hash();
-                auto && emplace_rv = evaluated_decks.insert({cur_deck, zero_results});
-                auto & prev_results = emplace_rv.first->second;
-                if (!emplace_rv.second)
-                {
-                    skipped_simulations += prev_results.second;
-                }
-                // Evaluate new deck
-				auto compare_results = proc.compare(best_score.n_sims, prev_results, best_score);
-				current_score = compute_score(compare_results, proc.factors);
-                // Is it better ?
-                if (new_gap < best_gap || current_score.points > best_score.points + min_increment_of_score)
+                if (debug_print > 0)
                 {
-                    // Then update best score/commander, print stuff
-                    std::cout << "Deck improved: " << d1->hash() << ": " << card_slot_id_names(cards_out) << " -> " << card_slot_id_names(cards_in) << ": ";
-                    best_gap = new_gap;
-                    best_score = current_score;
-                    best_deck = cur_deck;
-                    best_commander = d1->commander;
-                    best_cards = d1->cards;
-                    deck_has_been_improved = true;
-                    print_score_info(compare_results, proc.factors);
-                    print_deck_inline(deck_cost, best_score, d1);
+                    std::cout << "Dominated candidate: " << card_id_name(a) << " by " << card_id_name(b) << std::endl;
                 }
+                dominated_cards.insert(a->m_id);
+                break;
             }
-            // Now that all commanders are evaluated, take the best one
-            d1->commander = best_commander;
-            d1->cards = best_cards;
-        }
-        std::shuffle(non_commander_cards.begin(), non_commander_cards.end(), re);
-        for(const Card* card_candidate: non_commander_cards)
-        {
-            if (card_candidate && (card_candidate->m_fusion_level < use_fused_card_level || (use_top_level_card && card_candidate->m_level < card_candidate->m_top_level_card->m_level))
-                    && ! d1->allowed_candidates.count(card_candidate->m_id))
-            { continue; }
-            if (card_candidate && d1->disallowed_candidates.count(card_candidate->m_id))
-            { continue; }
-            d1->commander = best_commander;
-            d1->cards = best_cards;
-            if (card_candidate ?
-                    (slot_i < best_cards.size() && card_candidate->m_name == best_cards[slot_i]->m_name)    // Omega -> Omega
-                    :
-                    (slot_i == best_cards.size()))  // void -> void
-            { continue; }
-            cards_out.clear();
-            if (slot_i < d1->cards.size())
-            {
-                cards_out.emplace_back(-1, d1->cards[slot_i]);
-                d1->cards.erase(d1->cards.begin() + slot_i);
-            }
-            if (! adjust_deck(d1, slot_i, slot_i, card_candidate, fund, re, deck_cost, cards_out, cards_in) ||
-                    d1->cards.size() < min_deck_len)
-            { continue; }
-            unsigned new_gap = check_requirement(d1, requirement, quest);
-            if (new_gap > 0 && new_gap >= best_gap)
-            { continue; }
-            auto && cur_deck = d1->hash();
-            auto && emplace_rv = evaluated_decks.insert({cur_deck, zero_results});
-            auto & prev_results = emplace_rv.first->second;
-            if (!emplace_rv.second)
-            {
-                skipped_simulations += prev_results.second;
-            }
-            // Evaluate new deck
-            auto compare_results = proc.compare(best_score.n_sims, prev_results, best_score);
-            current_score = compute_score(compare_results, proc.factors);
-            // Is it better ?
-            if (new_gap < best_gap || current_score.points > best_score.points + min_increment_of_score)
-            {
-                // Then update best score/slot, print stuff
-                std::cout << "Deck improved: " << d1->hash() << ": " << card_slot_id_names(cards_out) << " -> " << card_slot_id_names(cards_in) << ": ";
-                best_gap = new_gap;
-                best_score = current_score;
-                best_deck = cur_deck;
-                best_commander = d1->commander;
-                best_cards = d1->cards;
-                deck_has_been_improved = true;
-                print_score_info(compare_results, proc.factors);
-                print_deck_inline(deck_cost, best_score, d1);
-            }
-            if(best_score.points - target_score > -1e-9)
-            { break; }
         }
-        d1->commander = best_commander;
-        d1->cards = best_cards;
     }
-    unsigned simulations = 0;
-    for(auto evaluation: evaluated_decks)
-    { simulations += evaluation.second.second; }
-    std::cout << "Evaluated " << evaluated_decks.size() << " decks (" << simulations << " + " << skipped_simulations << " simulations)." << std::endl;
-    std::cout << "Optimized Deck: ";
-    print_deck_inline(get_deck_cost(d1), best_score, d1);
 }
 //------------------------------------------------------------------------------
-void hill_climbing_ordered(unsigned num_min_iterations, unsigned num_iterations, Deck* d1, Process& proc, Requirement & requirement, Quest & quest)
+// Move generator of the climb engine.
+// Every candidate card taken into from_slot is tried at each slot of to_slots(from_slot, number of cards, candidate).
+struct ClimbMoves
+{
+    unsigned first_slot;  // slots before it are never changed
+    std::function<std::pair<unsigned, unsigned>(unsigned, unsigned, const Card*)> to_slots;  // [first, last)
+    bool report_slots;  // print the slots of the cards moved in and out
+    bool commanders_stop_at_target;  // try no more commanders once the target score is reached
+};
+
+// random decks: replace the card at a slot
+ClimbMoves slot_replace_moves()
+{
+    return {0, [](unsigned from_slot, unsigned, const Card*) { return std::make_pair(from_slot, from_slot + 1); }, false, false};
+}
+
+// ordered decks: take the card at from_slot out, put the candidate at any unfrozen slot
+ClimbMoves slot_move_moves()
+{
+    return {freezed_cards, [](unsigned from_slot, unsigned num_cards, const Card* card_candidate)
+        { return std::make_pair(card_candidate ? freezed_cards : num_cards - 1, num_cards + (from_slot < num_cards ? 0 : 1)); }, true, true};
+}
+
+// Acceptance policy of the climb engine: whether the candidate deck replaces the best deck.
+typedef std::function<bool(unsigned, const FinalResults<long double> &, unsigned, const FinalResults<long double> &)> ClimbAcceptance;
+
+bool accept_improvement(unsigned new_gap, const FinalResults<long double> & current_score, unsigned best_gap, const FinalResults<long double> & best_score)
 {
-	EvaluatedResults zero_results = { EvaluatedResults::first_type(proc.enemy_decks.size()), 0 };
+    return new_gap < best_gap || current_score.points > best_score.points + min_increment_of_score;
+}
+
+void climb_deck(unsigned num_min_iterations, unsigned num_iterations, Deck* d1, Process& proc, Requirement & requirement, Quest & quest,
+        const ClimbMoves & moves, const ClimbAcceptance & accept = accept_improvement)
+{
+    EvaluatedResults zero_results = { EvaluatedResults::first_type(proc.enemy_decks.size()), 0 };
     auto best_deck = d1->hash();
     std::map<std::string, EvaluatedResults> evaluated_decks{{best_deck, zero_results}};
     EvaluatedResults & results = proc.evaluate(num_min_iterations, evaluated_decks.begin()->second);
     print_score_info(results, proc.factors);
+    print_json_record("initial", d1, results, proc.factors);
     auto current_score = compute_score(results, proc.factors);
     auto best_score = current_score;
     // Non-commander cards
@@ -1001,13 +1605,45 @@ void hill_climbing_ordered(unsigned num_min_iterations, unsigned num_iterations,
     bool deck_has_been_improved = true;
     unsigned long skipped_simulations = 0;
     std::vector<std::pair<signed, const Card *>> cards_out, cards_in;
-    for(unsigned from_slot(freezed_cards), dead_slot(freezed_cards); ; from_slot = (from_slot + 1) % std::min<unsigned>(max_deck_len, d1->cards.size() + 1))
+    // Evaluate d1 against the best deck; take it if accepted
+    auto try_deck = [&]()
     {
-        if (from_slot < freezed_cards)
+        unsigned new_gap = check_requirement(d1, requirement, quest);
+        if (new_gap > 0 && new_gap >= best_gap)
+        { return; }
+        auto && cur_deck = d1->hash();
+        auto && emplace_rv = evaluated_decks.insert({cur_deck, zero_results});
+        auto & prev_results = emplace_rv.first->second;
+        if (!emplace_rv.second)
+        {
+            skipped_simulations += prev_results.second;
+        }
+        // Evaluate new deck
+        auto compare_results = proc.compare(best_score.n_sims, prev_results, best_score);
+        current_score = compute_score(compare_results, proc.factors);
+        // Is it better ?
+        if (accept(new_gap, current_score, best_gap, best_score))
+        {
+            // Then update best score/commander/slot, print stuff
+            std::cout << "Deck improved: " << d1->hash() << ": " << card_slot_id_names(cards_out) << " -> " << card_slot_id_names(cards_in) << ": ";
+            best_gap = new_gap;
+            best_score = current_score;
+            best_deck = cur_deck;
+            best_commander = d1->commander;
+            best_cards = d1->cards;
+            deck_has_been_improved = true;
+            print_score_info(compare_results, proc.factors);
+            print_deck_inline(deck_cost, best_score, d1);
+            print_json_record("improved", d1, compare_results, proc.factors);
+        }
+    };
+    for(unsigned from_slot(moves.first_slot), dead_slot(moves.first_slot); ; from_slot = (from_slot + 1) % std::min<unsigned>(max_deck_len, best_cards.size() + 1))
+    {
+        if (from_slot < moves.first_slot)
         {
             continue;
         }
-        if(deck_has_been_improved)
+        if (deck_has_been_improved)
         {
             dead_slot = from_slot;
             deck_has_been_improved = false;
@@ -1025,6 +1661,7 @@ void hill_climbing_ordered(unsigned num_min_iterations, unsigned num_iterations,
             best_score = compute_score(evaluate_result, proc.factors);
             std::cout << "Results refined: ";
             print_score_info(evaluate_result, proc.factors);
+            print_json_record("refined", d1, evaluate_result, proc.factors);
             dead_slot = from_slot;
         }
         if (best_score.points - target_score > -1e-9)
@@ -1035,46 +1672,19 @@ void hill_climbing_ordered(unsigned num_min_iterations, unsigned num_iterations,
         {
             for(const Card* commander_candidate: proc.cards.player_commanders)
             {
-                if(best_score.points - target_score > -1e-9)
+                if(moves.commanders_stop_at_target && best_score.points - target_score > -1e-9)
                 { break; }
                 // Various checks to check if the card is accepted
                 assert(commander_candidate->m_type == CardType::commander);
                 if (commander_candidate->m_name == best_commander->m_name)
                 { continue; }
                 d1->cards = best_cards;
-                // Place it in the deck
-                cards_out.clear();
-                cards_out.emplace_back(-1, best_commander);
+                // Place it in the deck and restore other cards
+                cards_out = {{-1, best_commander}};
                 d1->commander = commander_candidate;
                 if (! adjust_deck(d1, -1, -1, nullptr, fund, re, deck_cost, cards_out, cards_in))
                 { continue; }
-                unsigned new_gap = check_requirement(d1, requirement, quest);
-                if (new_gap > 0 && new_gap >= best_gap)
-                { continue; }
-                auto && cur_deck = d1->hash();
-                auto && emplace_rv = evaluated_decks.insert({cur_deck, zero_results});
-                auto & prev_results = emplace_rv.first->second;
-                if (!emplace_rv.second)
-                {
-                    skipped_simulations += prev_results.second;
-                }
-                // Evaluate new deck
-                auto compare_results = proc.compare(best_score.n_sims, prev_results, best_score);
-                current_score = compute_score(compare_results, proc.factors);
-                // Is it better ?
-                if (new_gap < best_gap || current_score.points > best_score.points + min_increment_of_score)
-                {
-                    std::cout << "Deck improved: " << d1->hash() << ": " << card_slot_id_names(cards_out) << " -> " << card_slot_id_names(cards_in) << ": ";
-                    // Then update best score/commander, print stuff
-                    best_gap = new_gap;
-                    best_score = current_score;
-                    best_deck = cur_deck;
-                    best_commander = commander_candidate;
-                    best_cards = d1->cards;
-                    deck_has_been_improved = true;
-                    print_score_info(compare_results, proc.factors);
-                    print_deck_inline(deck_cost, best_score, d1);
-                }
+                try_deck();
             }
             // Now that all commanders are evaluated, take the best one
             d1->commander = best_commander;
@@ -1083,14 +1693,13 @@ void hill_climbing_ordered(unsigned num_min_iterations, unsigned num_iterations,
         std::shuffle(non_commander_cards.begin(), non_commander_cards.end(), re);
         for(const Card* card_candidate: non_commander_cards)
         {
-            if (card_candidate && (card_candidate->m_fusion_level < use_fused_card_level || (use_top_level_card && card_candidate->m_level < card_candidate->m_top_level_card->m_level))
-                    && ! d1->allowed_candidates.count(card_candidate->m_id))
-            { continue; }
-            if (card_candidate && d1->disallowed_candidates.count(card_candidate->m_id))
+            if (card_candidate && ! is_candidate_allowed(d1, card_candidate))
             { continue; }
             // Various checks to check if the card is accepted
             assert(!card_candidate || card_candidate->m_type != CardType::commander);
-            for(unsigned to_slot(card_candidate ? freezed_cards : best_cards.size() - 1); to_slot < best_cards.size() + (from_slot < best_cards.size() ? 0 : 1); ++to_slot)
+            // the upper slot follows best_cards, which may grow or shrink within the loop
+            for(unsigned to_slot(moves.to_slots(from_slot, best_cards.size(), card_candidate).first);
+                    to_slot < moves.to_slots(from_slot, best_cards.size(), card_candidate).second; ++to_slot)
             {
                 d1->commander = best_commander;
                 d1->cards = best_cards;
@@ -1102,39 +1711,13 @@ void hill_climbing_ordered(unsigned num_min_iterations, unsigned num_iterations,
                 cards_out.clear();
                 if (from_slot < d1->cards.size())
                 {
-                    cards_out.emplace_back(from_slot, d1->cards[from_slot]);
+                    cards_out.emplace_back(moves.report_slots ? (signed)from_slot : -1, d1->cards[from_slot]);
                     d1->cards.erase(d1->cards.begin() + from_slot);
                 }
                 if (! adjust_deck(d1, from_slot, to_slot, card_candidate, fund, re, deck_cost, cards_out, cards_in) ||
                         d1->cards.size() < min_deck_len)
                 { continue; }
-                unsigned new_gap = check_requirement(d1, requirement, quest);
-                if (new_gap > 0 && new_gap >= best_gap)
-                { continue; }
-                auto && cur_deck = d1->hash();
-                auto && emplace_rv = evaluated_decks.insert({cur_deck, zero_results});
-                auto & prev_results = emplace_rv.first->second;
-                if (!emplace_rv.second)
-                {
-                    skipped_simulations += prev_results.second;
-                }
-                // Evaluate new deck
-                auto compare_results = proc.compare(best_score.n_sims, prev_results, best_score);
-                current_score = compute_score(compare_results, proc.factors);
-                // Is it better ?
-                if (new_gap < best_gap || current_score.points > best_score.points + min_increment_of_score)
-                {
-                    // Then update best score/slot, print stuff
-                    std::cout << "Deck improved: " << d1->hash() << ": " << card_slot_id_names(cards_out) << " -> " << card_slot_id_names(cards_in) << ": ";
-                    best_gap = new_gap;
-                    best_score = current_score;
-                    best_deck = cur_deck;
-                    best_commander = d1->commander;
-                    best_cards = d1->cards;
-                    deck_has_been_improved = true;
-                    print_score_info(compare_results, proc.factors);
-                    print_deck_inline(deck_cost, best_score, d1);
-                }
+                try_deck();
             }
             if(best_score.points - target_score > -1e-9)
             { break; }
@@ -1148,6 +1731,507 @@ void hill_climbing_ordered(unsigned num_min_iterations, unsigned num_iterations,
     std::cout << "Evaluated " << evaluated_decks.size() << " decks (" << simulations << " + " << skipped_simulations << " simulations)." << std::endl;
     std::cout << "Optimized Deck: ";
     print_deck_inline(get_deck_cost(d1), best_score, d1);
+    print_json_record("optimized", d1, evaluated_decks[best_deck], proc.factors);
+}
+//------------------------------------------------------------------------------
+void hill_climbing(unsigned num_min_iterations, unsigned num_iterations, Deck* d1, Process& proc, Requirement & requirement, Quest & quest)
+{
+    climb_deck(num_min_iterations, num_iterations, d1, proc, requirement, quest, slot_replace_moves());
+}
+//------------------------------------------------------------------------------
+void hill_climbing_ordered(unsigned num_min_iterations, unsigned num_iterations, Deck* d1, Process& proc, Requirement & requirement, Quest & quest)
+{
+    climb_deck(num_min_iterations, num_iterations, d1, proc, requirement, quest, slot_move_moves());
+}
+//------------------------------------------------------------------------------
+struct Individual
+{
+    const Card* commander;
+    std::vector<const Card*> cards;
+    EvaluatedResults* results;
+    FinalResults<long double> score;
+    unsigned gap;
+};
+
+// apply one random climbing move (change commander, replace/insert/remove/move a card) to d1
+// return true if d1 has been changed into a valid deck
+bool mutate_deck(Deck* d1, const std::vector<const Card*> & commander_candidates, const std::vector<const Card*> & card_candidates, std::mt19937 & re, unsigned max_gap)
+{
+    std::vector<std::pair<signed, const Card *>> cards_out, cards_in;
+    unsigned deck_cost;
+    bool is_random = d1->strategy == DeckStrategy::random;
+    unsigned num_cards = d1->cards.size();
+    if (requirement.num_cards.count(d1->commander) == 0 && !commander_candidates.empty() && re() % (num_cards + 1) == 0)
+    {
+        const Card* commander_candidate = commander_candidates[re() % commander_candidates.size()];
+        if (commander_candidate->m_name == d1->commander->m_name)
+        { return false; }
+        cards_out.emplace_back(-1, d1->commander);
+        d1->commander = commander_candidate;
+        if (! adjust_deck(d1, -1, -1, nullptr, fund, re, deck_cost, cards_out, cards_in))
+        { return false; }
+    }
+    else
+    {
+        unsigned first_slot = is_random ? 0 : std::min(freezed_cards, num_cards);
+        unsigned end_slot = std::min<unsigned>(max_deck_len, num_cards + 1);
+        if (end_slot <= first_slot)
+        { return false; }
+        unsigned from_slot = first_slot + re() % (end_slot - first_slot);
+        const Card* card_candidate = card_candidates[re() % card_candidates.size()];
+        unsigned to_slot = from_slot;
+        if (card_candidate ?
+                (from_slot < num_cards && card_candidate->m_name == d1->cards[from_slot]->m_name && (is_random || re() % 2 == 0))
+                :
+                (from_slot == num_cards))
+        { return false; }
+        if (! is_random)
+        {
+            // move the card to any unfrozen slot
+            to_slot = card_candidate ? first_slot + re() % (num_cards + (from_slot < num_cards ? 0 : 1) - first_slot) : num_cards - 1;
+        }
+        if (from_slot < num_cards)
+        {
+            cards_out.emplace_back(is_random ? -1 : (signed)from_slot, d1->cards[from_slot]);
+            d1->cards.erase(d1->cards.begin() + from_slot);
+        }
+        if (! adjust_deck(d1, from_slot, to_slot, card_candidate, fund, re, deck_cost, cards_out, cards_in))
+        { return false; }
+    }
+    return d1->cards.size() >= min_deck_len && check_requirement(d1, requirement, quest) <= max_gap;
+}
+
+// build d1 from the cards of two parents
+// return true if d1 is a valid deck
+bool crossover_decks(Deck* d1, const Individual & a, const Individual & b, std::mt19937 & re, unsigned max_gap)
+{
+    d1->commander = re() % 2 ? a.commander : b.commander;
+    d1->cards.clear();
+    if (d1->strategy == DeckStrategy::random)
+    {
+        // draw from the union of the parents' multisets; each card at most as many times as in either parent
+        std::map<const Card*, std::pair<unsigned, unsigned>> num_cards;
+        for (const Card* card: a.cards) { ++ num_cards[card].first; }
+        for (const Card* card: b.cards) { ++ num_cards[card].second; }
+        std::vector<const Card*> pool;
+        for (const auto & it: num_cards)
+        {
+            pool.insert(pool.end(), std::max(it.second.first, it.second.second), it.first);
+        }
+        std::shuffle(pool.begin(), pool.end(), re);
+        unsigned min_len = std::min(a.cards.size(), b.cards.size());
+        unsigned max_len = std::max(a.cards.size(), b.cards.size());
+        pool.resize(min_len + re() % (max_len - min_len + 1));
+        d1->cards = pool;
+    }
+    else
+    {
+        // one-point crossover, so that every card keeps its position
+        unsigned cut = freezed_cards + re() % (std::min(a.cards.size(), b.cards.size()) - freezed_cards + 1);
+        d1->cards.assign(a.cards.begin(), a.cards.begin() + cut);
+        d1->cards.insert(d1->cards.end(), b.cards.begin() + cut, b.cards.end());
+    }
+    return d1->cards.size() >= min_deck_len && d1->cards.size() <= max_deck_len &&
+        get_deck_cost(d1) <= fund && check_requirement(d1, requirement, quest) <= max_gap;
+}
+
+void genetic_search(unsigned num_iterations, Deck* d1, Process& proc, Requirement & requirement, Quest & quest)
+{
+    EvaluatedResults zero_results = { EvaluatedResults::first_type(proc.enemy_decks.size()), 0 };
+    std::map<std::string, EvaluatedResults> evaluated_decks;
+    std::mt19937 & re = proc.threads_data[0]->re;
+    std::vector<const Card*> commander_candidates(proc.cards.player_commanders.begin(), proc.cards.player_commanders.end());
+    auto non_commander_cards = proc.cards.player_assaults;
+    non_commander_cards.insert(non_commander_cards.end(), proc.cards.player_structures.begin(), proc.cards.player_structures.end());
+    std::vector<const Card*> card_candidates{nullptr};
+    for (const Card* card: non_commander_cards)
+    {
+        if (is_candidate_allowed(d1, card))
+        { card_candidates.emplace_back(card); }
+    }
+    unsigned deck_cost = get_deck_cost(d1);
+    fund = std::max(fund, deck_cost);
+    const unsigned max_gap = check_requirement(d1, requirement, quest);
+    const Card* initial_commander = d1->commander;
+    std::vector<const Card*> initial_cards = d1->cards;
+    unsigned long skipped_simulations = 0;
+
+    std::vector<Individual> population;
+    std::set<std::string> population_hashes;
+    auto add_individual = [&](std::vector<Individual> & pop, std::set<std::string> & pop_hashes)
+    {
+        auto && cur_deck = d1->hash();
+        if (! pop_hashes.insert(cur_deck).second)
+        { return; }
+        auto && emplace_rv = evaluated_decks.insert({cur_deck, zero_results});
+        if (!emplace_rv.second)
+        {
+            skipped_simulations += emplace_rv.first->second.second;
+        }
+        pop.push_back({d1->commander, d1->cards, &emplace_rv.first->second, {0, 0, 0, 0, 0, 0, 0}, check_requirement(d1, requirement, quest)});
+    };
+
+    // initial population: the given deck and a few random moves away from it
+    add_individual(population, population_hashes);
+    for (unsigned attempt = 0; population.size() < population_size && attempt < population_size * 20; ++ attempt)
+    {
+        d1->commander = initial_commander;
+        d1->cards = initial_cards;
+        bool mutated = false;
+        for (unsigned num_moves = 1 + re() % 3; num_moves > 0; -- num_moves)
+        {
+            auto saved_commander = d1->commander;
+            auto saved_cards = d1->cards;
+            if (mutate_deck(d1, commander_candidates, card_candidates, re, max_gap))
+            { mutated = true; }
+            else
+            {
+                d1->commander = saved_commander;
+                d1->cards = saved_cards;
+            }
+        }
+        if (mutated)
+        { add_individual(population, population_hashes); }
+    }
+
+    auto better = [](const Individual & a, const Individual & b)
+    { return a.gap < b.gap || (a.gap == b.gap && a.score.points > b.score.points); };
+    auto tournament = [&]() -> const Individual &
+    {
+        unsigned best_index = re() % population.size();
+        for (unsigned i = 1; i < 3; ++ i)
+        {
+            best_index = std::min<unsigned>(best_index, re() % population.size());
+        }
+        return population[best_index];
+    };
+    Individual best{initial_commander, initial_cards, nullptr, {0, 0, 0, 0, 0, 0, 0}, max_gap};
+    for (unsigned generation = 0; ; ++ generation)
+    {
+        // evaluate the whole generation at once to keep all threads busy
+        std::vector<std::shared_ptr<Deck>> batch_decks;
+        std::vector<std::pair<const Deck*, EvaluatedResults*>> batch;
+        for (const auto & individual: population)
+        {
+            batch_decks.emplace_back(d1->clone());
+            batch_decks.back()->commander = individual.commander;
+            batch_decks.back()->cards = individual.cards;
+            batch.emplace_back(batch_decks.back().get(), individual.results);
+        }
+        proc.evaluate_batch(num_iterations, batch);
+        for (auto & individual: population)
+        {
+            individual.score = compute_score(*individual.results, proc.factors);
+        }
+        if (generation == 0)
+        {
+            // the given deck is the first individual of the initial population
+            d1->commander = initial_commander;
+            d1->cards = initial_cards;
+            print_json_record("initial", d1, *population[0].results, proc.factors);
+        }
+        std::sort(population.begin(), population.end(), better);
+        if (generation == 0 || population[0].gap < best.gap || population[0].score.points > best.score.points + min_increment_of_score)
+        {
+            best = population[0];
+            d1->commander = best.commander;
+            d1->cards = best.cards;
+            std::cout << "Deck improved: " << d1->hash() << ": generation " << generation << ": ";
+            print_score_info(*best.results, proc.factors);
+            print_deck_inline(get_deck_cost(d1), best.score, d1);
+            print_json_record("improved", d1, *best.results, proc.factors);
+        }
+        if (generation + 1 >= num_generations || (best.gap == 0 && best.score.points - target_score > -1e-9))
+        { break; }
+
+        // next generation: elites survive, the rest are offspring of tournament winners
+        std::vector<Individual> next_population;
+        std::set<std::string> next_population_hashes;
+        for (unsigned i = 0; i < std::max(1u, population_size / 8) && i < population.size(); ++ i)
+        {
+            d1->commander = population[i].commander;
+            d1->cards = population[i].cards;
+            add_individual(next_population, next_population_hashes);
+        }
+        for (unsigned attempt = 0; next_population.size() < population_size && attempt < population_size * 20; ++ attempt)
+        {
+            const Individual & a = tournament();
+            const Individual & b = tournament();
+            bool valid = re() % 10 < 7 && crossover_decks(d1, a, b, re, max_gap);
+            if (! valid || re() % 2 == 0)
+            {
+                if (! valid)
+                {
+                    d1->commander = a.commander;
+                    d1->cards = a.cards;
+                }
+                auto saved_commander = d1->commander;
+                auto saved_cards = d1->cards;
+                if (mutate_deck(d1, commander_candidates, card_candidates, re, max_gap))
+                { valid = true; }
+                else
+                {
+                    d1->commander = saved_commander;
+                    d1->cards = saved_cards;
+                }
+            }
+            if (valid)
+            { add_individual(next_population, next_population_hashes); }
+        }
+        population.swap(next_population);
+    }
+    d1->commander = best.commander;
+    d1->cards = best.cards;
+    unsigned simulations = 0;
+    for(auto evaluation: evaluated_decks)
+    { simulations += evaluation.second.second; }
+    std::cout << "Evaluated " << evaluated_decks.size() << " decks (" << simulations << " + " << skipped_simulations << " simulations)." << std::endl;
+    std::cout << "Optimized Deck: ";
+    print_deck_inline(get_deck_cost(d1), best.score, d1);
+    print_json_record("optimized", d1, *best.results, proc.factors);
+}
+//------------------------------------------------------------------------------
+void beam_climbing(unsigned num_iterations, Deck* d1, Process& proc, Requirement & requirement, Quest & quest)
+{
+    EvaluatedResults zero_results = { EvaluatedResults::first_type(proc.enemy_decks.size()), 0 };
+    std::map<std::string, EvaluatedResults> evaluated_decks;
+    std::mt19937 & re = proc.threads_data[0]->re;
+    auto non_commander_cards = proc.cards.player_assaults;
+    non_commander_cards.insert(non_commander_cards.end(), proc.cards.player_structures.begin(), proc.cards.player_structures.end());
+    std::vector<const Card*> card_candidates{nullptr};
+    for (const Card* card: non_commander_cards)
+    {
+        if (is_candidate_allowed(d1, card))
+        { card_candidates.emplace_back(card); }
+    }
+    unsigned deck_cost = get_deck_cost(d1);
+    fund = std::max(fund, deck_cost);
+    const unsigned max_gap = check_requirement(d1, requirement, quest);
+    const unsigned first_slot = d1->strategy == DeckStrategy::random ? 0 : freezed_cards;
+    unsigned long skipped_simulations = 0;
+    std::vector<std::pair<signed, const Card *>> cards_out, cards_in;
+    auto better = [](const Individual & a, const Individual & b)
+    { return a.gap < b.gap || (a.gap == b.gap && a.score.points > b.score.points); };
+    // evaluate decks with successive halving: start with few simulations each, double them and drop the worse half until beam_width remain
+    auto evaluate_frontier = [&](std::vector<Individual> & frontier)
+    {
+        std::vector<std::shared_ptr<Deck>> batch_decks;
+        for (const auto & individual: frontier)
+        {
+            batch_decks.emplace_back(d1->clone());
+            batch_decks.back()->commander = individual.commander;
+            batch_decks.back()->cards = individual.cards;
+        }
+        std::vector<unsigned> alive(frontier.size());
+        std::iota(alive.begin(), alive.end(), 0);
+        unsigned num_rounds = 0;
+        for (size_t n = frontier.size(); n > beam_width; n = (n + 1) / 2)
+        { ++ num_rounds; }
+        for (unsigned num_sims = std::max(1u, num_iterations >> num_rounds); ; num_sims = std::min(num_sims * 2, num_iterations))
+        {
+            std::vector<std::pair<const Deck*, EvaluatedResults*>> batch;
+            for (unsigned i: alive)
+            { batch.emplace_back(batch_decks[i].get(), frontier[i].results); }
+            proc.evaluate_batch(num_sims, batch);
+            for (unsigned i: alive)
+            { frontier[i].score = compute_score(*frontier[i].results, proc.factors); }
+            std::sort(alive.begin(), alive.end(), [&](unsigned a, unsigned b) { return better(frontier[a], frontier[b]); });
+            if (alive.size() <= beam_width && num_sims >= num_iterations)
+            { break; }
+            alive.resize(std::max<size_t>(beam_width, (alive.size() + 1) / 2));
+        }
+        std::vector<Individual> survivors;
+        for (unsigned i: alive)
+        { survivors.push_back(frontier[i]); }
+        frontier.swap(survivors);
+    };
+    std::set<std::string> seen_hashes;
+    auto add_individual = [&](std::vector<Individual> & pop)
+    {
+        auto && cur_deck = d1->hash();
+        if (! seen_hashes.insert(cur_deck).second)
+        { return; }
+        auto && emplace_rv = evaluated_decks.insert({cur_deck, zero_results});
+        if (!emplace_rv.second)
+        {
+            skipped_simulations += emplace_rv.first->second.second;
+        }
+        pop.push_back({d1->commander, d1->cards, &emplace_rv.first->second, {0, 0, 0, 0, 0, 0, 0}, check_requirement(d1, requirement, quest)});
+    };
+
+    std::vector<Individual> beam;
+    add_individual(beam);
+    evaluate_frontier(beam);
+    Individual best = beam[0];
+    print_score_info(*best.results, proc.factors);
+    print_deck_inline(deck_cost, best.score, d1);
+    print_json_record("initial", d1, *best.results, proc.factors);
+    bool deck_has_been_improved = true;
+    for(unsigned slot_i(first_slot), dead_slot(first_slot); ; slot_i = std::max(first_slot, (slot_i + 1) % std::min<unsigned>(max_deck_len, best.cards.size() + 1)))
+    {
+        if (deck_has_been_improved)
+        {
+            dead_slot = slot_i;
+            deck_has_been_improved = false;
+        }
+        else if (slot_i == dead_slot)
+        {
+            break;
+        }
+        if (best.gap == 0 && best.score.points - target_score > -1e-9)
+        {
+            break;
+        }
+        // expand every deck of the beam by all single-slot replacements
+        std::vector<Individual> frontier;
+        seen_hashes.clear();
+        for (const auto & individual: beam)
+        {
+            d1->commander = individual.commander;
+            d1->cards = individual.cards;
+            seen_hashes.insert(d1->hash());
+        }
+        for (const auto & individual: beam)
+        {
+            if (requirement.num_cards.count(individual.commander) == 0)
+            {
+                for (const Card* commander_candidate: proc.cards.player_commanders)
+                {
+                    if (commander_candidate->m_name == individual.commander->m_name)
+                    { continue; }
+                    d1->cards = individual.cards;
+                    cards_out = {{-1, individual.commander}};
+                    d1->commander = commander_candidate;
+                    if (! adjust_deck(d1, -1, -1, nullptr, fund, re, deck_cost, cards_out, cards_in) ||
+                            check_requirement(d1, requirement, quest) > max_gap)
+                    { continue; }
+                    add_individual(frontier);
+                }
+            }
+            unsigned slot = std::min<unsigned>(slot_i, individual.cards.size());
+            if (slot >= max_deck_len)
+            { continue; }
+            for (const Card* card_candidate: card_candidates)
+            {
+                d1->commander = individual.commander;
+                d1->cards = individual.cards;
+                if (card_candidate ?
+                        (slot < individual.cards.size() && card_candidate->m_name == individual.cards[slot]->m_name)    // Omega -> Omega
+                        :
+                        (slot == individual.cards.size()))  // void -> void
+                { continue; }
+                cards_out.clear();
+                if (slot < d1->cards.size())
+                {
+                    cards_out.emplace_back(-1, d1->cards[slot]);
+                    d1->cards.erase(d1->cards.begin() + slot);
+                }
+                if (! adjust_deck(d1, slot, slot, card_candidate, fund, re, deck_cost, cards_out, cards_in) ||
+                        d1->cards.size() < min_deck_len || check_requirement(d1, requirement, quest) > max_gap)
+                { continue; }
+                add_individual(frontier);
+            }
+        }
+        if (frontier.empty())
+        {
+            continue;
+        }
+        evaluate_frontier(frontier);
+        // the new beam is the top beam_width of the old beam and the surviving frontier
+        beam.insert(beam.end(), frontier.begin(), frontier.end());
+        std::stable_sort(beam.begin(), beam.end(), better);
+        beam.resize(std::min<size_t>(beam.size(), beam_width));
+        if (beam[0].gap < best.gap || beam[0].score.points > best.score.points + min_increment_of_score)
+        {
+            best = beam[0];
+            d1->commander = best.commander;
+            d1->cards = best.cards;
+            deck_has_been_improved = true;
+            std::cout << "Deck improved: " << d1->hash() << ": ";
+            print_score_info(*best.results, proc.factors);
+            print_deck_inline(get_deck_cost(d1), best.score, d1);
+            print_json_record("improved", d1, *best.results, proc.factors);
+        }
+    }
+    d1->commander = best.commander;
+    d1->cards = best.cards;
+    unsigned simulations = 0;
+    for(auto evaluation: evaluated_decks)
+    { simulations += evaluation.second.second; }
+    std::cout << "Evaluated " << evaluated_decks.size() << " decks (" << simulations << " + " << skipped_simulations << " simulations)." << std::endl;
+    std::cout << "Optimized Deck: ";
+    print_deck_inline(get_deck_cost(d1), best.score, d1);
+    print_json_record("optimized", d1, *best.results, proc.factors);
+}
+//------------------------------------------------------------------------------
+// Enumerate all distinct orders of the non-frozen cards (duplicates collapsed) and race them:
+// simulate every remaining order, double the simulations, drop the orders whose upper bound falls below the best lower bound.
+// Return false without simulating if there are more than max_num_orders orders.
+bool reorder_exhaustively(unsigned num_iterations, Deck* d1, Process& proc)
+{
+    auto by_id = [](const Card* a, const Card* b) { return a->m_id < b->m_id; };
+    std::vector<const Card*> cards(d1->cards.begin() + freezed_cards, d1->cards.end());
+    std::sort(cards.begin(), cards.end(), by_id);
+    // number of distinct orders: multinomial coefficient n! / (k1! k2! ...)
+    unsigned long long num_orders = 1;
+    for (unsigned i = 0, num_same = 0; i < cards.size(); ++ i)
+    {
+        num_same = i > 0 && cards[i] == cards[i - 1] ? num_same + 1 : 1;
+        num_orders = num_orders * (i + 1) / num_same;
+        if (num_orders > max_num_orders)
+        {
+            std::cout << "More than " << max_num_orders << " distinct orders; falling back to hill-climbing." << std::endl;
+            return false;
+        }
+    }
+    // Forked battles shuffle the positions of the cards, so there must be no given hand or upgrades to draw;
+    // quest scores also count the cards left in the deck.
+    bool forked = fork_orders && d1->given_hand.empty() && d1->upgrade_points == 0 && optimization_mode != OptimizationMode::quest;
+    std::vector<std::shared_ptr<Deck>> orders;
+    unsigned initial = 0;
+    do
+    {
+        orders.emplace_back(d1->clone());
+        std::copy(cards.begin(), cards.end(), orders.back()->cards.begin() + freezed_cards);
+        if (orders.back()->cards == d1->cards)
+        { initial = orders.size() - 1; }
+    } while (std::next_permutation(cards.begin(), cards.end(), by_id));
+
+    EvaluatedResults zero_results = { EvaluatedResults::first_type(proc.enemy_decks.size()), 0 };
+    std::vector<EvaluatedResults> results(orders.size(), zero_results);
+    std::vector<FinalResults<long double>> scores(orders.size());
+    std::vector<unsigned> alive(orders.size());
+    std::iota(alive.begin(), alive.end(), 0);
+    std::cout << orders.size() << " distinct orders." << std::endl;
+    for (unsigned num_sims = std::min(num_iterations, std::max(10u, num_iterations >> 6)); ; num_sims = std::min(num_sims * 2, num_iterations))
+    {
+        std::vector<std::pair<const Deck*, EvaluatedResults*>> batch;
+        for (unsigned i: alive)
+        { batch.emplace_back(orders[i].get(), &results[i]); }
+        proc.evaluate_batch(num_sims, batch, forked);
+        long double best_lower_bound = 0;
+        for (unsigned i: alive)
+        {
+            scores[i] = compute_score(results[i], proc.factors);
+            best_lower_bound = std::max(best_lower_bound, scores[i].points_lower_bound);
+        }
+        alive.erase(std::remove_if(alive.begin(), alive.end(), [&](unsigned i) { return scores[i].points_upper_bound < best_lower_bound; }), alive.end());
+        std::cout << alive.size() << " orders left after " << num_sims << " simulations each." << std::endl;
+        if (alive.size() <= 1 || num_sims >= num_iterations)
+        { break; }
+    }
+    unsigned best = *std::max_element(alive.begin(), alive.end(), [&](unsigned a, unsigned b) { return scores[a].points < scores[b].points; });
+    // the given order, with the simulations it got before it was dropped
+    print_json_record("initial", d1, results[initial], proc.factors);
+    d1->cards = orders[best]->cards;
+    unsigned simulations = 0;
+    for (const auto & result: results)
+    { simulations += result.second; }
+    std::cout << "Evaluated " << orders.size() << " decks (" << simulations << " simulations)." << std::endl;
+    std::cout << "Optimized Deck: ";
+    print_deck_inline(get_deck_cost(d1), scores[best], d1);
+    print_json_record("optimized", d1, results[best], proc.factors);
+    return true;
 }
 //------------------------------------------------------------------------------
 enum Operation {
@@ -1155,6 +2239,9 @@ enum Operation {
     simulate,
     climb,
     reorder,
+    exact_reorder,
+    genetic,
+    beam,
     debug,
     debuguntil,
 };
@@ -1164,7 +2251,6 @@ std::string skill_description(const Cards& cards, const SkillSpec& s);
 //------------------------------------------------------------------------------
 // print possible Battle Ground Effects (BGE) to console
 //------------------------------------------------------------------------------
-extern void(*skill_table[Skill::num_skills])(Field*, CardStatus* src_status, const SkillSpec&);
 void print_available_effects()
 {
     std::cout << "Available effects besides activation skills:\n"
@@ -1191,6 +2277,10 @@ void usage(int argc, char** argv)
 {
     std::cout << "Tyrant Unleashed Optimizer (TUO) " << TYRANT_OPTIMIZER_VERSION << "\n"
         "usage: " << argv[0] << " Your_Deck Enemy_Deck [Flags] [Operations]\n"
+        "       " << argv[0] << " compile-db [_suffix ...]\n"
+        "       " << argv[0] << " daemon [_suffix ...] [socket <path>]\n"
+        "       " << argv[0] << " batch <file> [_suffix ...] [Flags]\n"
+        "       " << argv[0] << " bench-codec [<hash file>] [ext_b64|wmt_b64|ddd_b64]\n"
         "\n"
         "Your_Deck:\n"
         "  the name/hash/cards of a custom deck.\n"
@@ -1201,11 +2291,33 @@ void usage(int argc, char** argv)
         "  where deck is the name/hash/cards of a mission, raid, quest or custom deck, and factor is optional. The default factor is 1.\n"
         "  example: \'fear:0.2;slowroll:0.8\' means fear is the defense deck 20% of the time, while slowroll is the defense deck 80% of the time.\n"
         "\n"
+        "compile-db:\n"
+        "  compile the XML files in data/ (with the given suffixes) into data/tuo[_suffix].db. Later runs load this database instead of the XML files as long as none of them has changed.\n"
+        "\n"
+        "daemon:\n"
+        "  load the data once and answer requests read from stdin (or from the Unix domain socket <path>), one JSON object per line:\n"
+        "  {\"id\": \"1\", \"args\": [\"Your_Deck\", \"Enemy_Deck\", \"climb\", \"1000\"]}\n"
+        "  Each answer is one line: {\"id\": \"1\", \"status\": \"ok\", \"output\": \"...\", \"errors\": \"...\"}\n"
+        "  The status is \"error\" if the request failed. Requests use the file suffixes given to daemon.\n"
+        "\n"
+        "batch:\n"
+        "  load the data once and run the jobs listed in <file>, one 'Your_Deck Enemy_Deck [Flags] [Operations]' per line (quote arguments with spaces).\n"
+        "  The given suffixes and flags apply to every job. The output of each job is printed after a '// Job <line>: ...' header as soon as the job is done; a repeated job reuses the first output.\n"
+        "\n"
+        "bench-codec:\n"
+        "  decode and re-encode every hash of <hash file> (one per line), or of 100000 random decks, in the given codec (default ext_b64), and print the time per card.\n"
+        "\n"
         "Flags:\n"
         "  -e \"<effect>\": set the battleground effect; you may use -e multiple times.\n"
         "  -r: the attack deck is played in order instead of randomly (respects the 3 cards drawn limit).\n"
         "  -s: use surge (default is fight).\n"
         "  -t <num>: set the number of threads, default is 4.\n"
+        "  +early-end: after sim, report how many battles ended as soon as nothing could change their outcome, and the turns saved.\n"
+        "  +hist: after sim, print the distribution of the points of the battles against each enemy deck (mean, deviation, percentiles and counts).\n"
+        "  +lockstep: play battles whose cards have only strike, heal, armor, counter and poison several at a time in lanes (no effect with BGEs or quests).\n"
+        "  +lockstep-check: +lockstep, and replay each battle played in lanes with the usual engine to count the ones that end differently.\n"
+        "  +pin: pin simulation thread i to CPU i (modulo the number of CPUs), so that it stays next to its data (Linux only).\n"
+        "  json <file>: append a JSON line to <file> for the initial deck, each improvement and refinement, and the optimized deck of an optimization, or for the result of sim (type, deck hash, score, bounds, win/stall/loss rates, n_sims, per-enemy results, elapsed seconds). Candidate decks that bring no improvement are not written.\n"
         "  win:     simulate/optimize for win rate. default for non-raids.\n"
         "  defense: simulate/optimize for win rate + stall rate. can be used for defending deck or win rate oriented raid simulations.\n"
         "  raid:    simulate/optimize for average raid damage (ARD). default for raids.\n"
@@ -1216,11 +2328,23 @@ void usage(int argc, char** argv)
         "  -o=<filename>: restrict to the owned cards listed in <filename>.\n"
         "  fund <num>: invest <num> SP to upgrade cards.\n"
         "  target <num>: stop as soon as the score reaches <num>.\n"
+        "  +dom: skip candidates that are dominated by another available card of the same type and faction (no better stat or skill). Cards in your deck are never skipped; reorder ignores this flag.\n"
+        "Flags for exact-reorder:\n"
+        "  max-orders <num>: fall back to reorder if there are more than <num> distinct orders, default is 20000.\n"
+        "  +fork: race the orders in the same battles, playing the turns before the first differing card once for all the orders sharing them.\n"
+        "Flags for beam:\n"
+        "  beam-width <num>: number of decks kept after each pass, default is 4.\n"
+        "Flags for genetic:\n"
+        "  population <num>: number of decks in each generation, default is 16.\n"
+        "  generations <num>: number of generations, default is 20.\n"
         "\n"
         "Operations:\n"
         "  sim <num>: simulate <num> battles to evaluate a deck.\n"
         "  climb <num>: perform hill-climbing starting from the given attack deck, using up to <num> battles to evaluate a deck.\n"
         "  reorder <num>: optimize the order for given attack deck, using up to <num> battles to evaluate an order.\n"
+        "  exact-reorder <num>: find the best order for given attack deck by racing all distinct orders, using up to <num> battles to evaluate an order.\n"
+        "  genetic <num>: perform genetic search starting from the given attack deck, using <num> battles to evaluate a deck.\n"
+        "  beam <num>: perform beam search starting from the given attack deck, using up to <num> battles to evaluate a deck.\n"
 #ifndef NDEBUG
         "  debug: testing purpose only. very verbose output. only one battle.\n"
         "  debuguntil <min> <max>: testing purpose only. fight until the last fight results in range [<min>, <max>]. recommend to redirect output.\n"
@@ -1228,29 +2352,301 @@ void usage(int argc, char** argv)
         ;
 }
 
-
-//------------------------------------------------------------------------------
-// main function
-// - take over parameters (param count, param values) from user input
-// - ??
+
+//------------------------------------------------------------------------------
+// XML files compiled into the card database
+std::vector<std::string> card_db_sources(const std::vector<std::string> & fn_suffix_list)
+{
+    std::vector<std::string> source_files{"data/skills_set.xml"};
+    for (unsigned section = 0; section <= 10; ++ section)
+    {
+        source_files.push_back("data/cards_section_" + to_string(section) + ".xml");
+    }
+    for (const auto & suffix: fn_suffix_list)
+    {
+        source_files.push_back("data/missions" + suffix + ".xml");
+        source_files.push_back("data/raids" + suffix + ".xml");
+        source_files.push_back("data/fusion_recipes_cj2" + suffix + ".xml");
+    }
+    return source_files;
+}
+
+std::string card_db_filename(const std::vector<std::string> & fn_suffix_list)
+{
+    return "data/tuo" + boost::algorithm::join(fn_suffix_list, "") + ".db";
+}
+
+//------------------------------------------------------------------------------
+// load skills, cards, missions, raids and recipes from the XML files
+void load_xml_data(Cards & all_cards, Decks & decks, const std::vector<std::string> & fn_suffix_list)
+{
+	// load skills
+    load_skills_set_xml(all_cards, "data/skills_set.xml", true);
+	
+	// load available cards (the section files are parsed concurrently)
+    std::vector<std::string> section_filenames;
+	for (unsigned section = 0; section <= 10; ++ section)
+    {
+        section_filenames.push_back("data/cards_section_" + to_string(section) + ".xml");
+    }
+    load_cards_xml(all_cards, section_filenames, false);
+	
+	// sort skills + available cards
+    all_cards.organize();	
+    
+	
+	// load available missions, raids and recipes (the files are parsed concurrently)
+    std::vector<std::string> mission_filenames, raid_filenames, recipe_filenames;
+    for (const auto & suffix: fn_suffix_list)
+    {
+        mission_filenames.push_back("data/missions" + suffix + ".xml");
+        raid_filenames.push_back("data/raids" + suffix + ".xml");
+        recipe_filenames.push_back("data/fusion_recipes_cj2" + suffix + ".xml");
+    }
+    load_decks_and_recipes_xml(decks, all_cards, mission_filenames, raid_filenames, recipe_filenames);
+}
+
+//------------------------------------------------------------------------------
+// load all data files; use the compiled card database instead of the XML files if it is up to date
+void load_data(Cards & all_cards, Decks & decks, std::unordered_map<std::string, std::string> & bge_aliases, const std::vector<std::string> & fn_suffix_list)
+{
+    if (!load_card_db(all_cards, decks, card_db_filename(fn_suffix_list), card_db_sources(fn_suffix_list)))
+    {
+        load_xml_data(all_cards, decks, fn_suffix_list);
+    }
+	// load card abbreviations
+    for (const auto & suffix: fn_suffix_list)
+    {
+        read_card_abbrs(all_cards, "data/cardabbrs" + suffix + ".txt");
+    }
+    all_cards.name_index.build(all_cards);
+	// load custom decks
+    for (const auto & suffix: fn_suffix_list)
+    {
+        load_custom_decks(decks, all_cards, "data/customdecks" + suffix + ".txt");
+    }
+	// load Battle Ground Effect (BGE) aliases
+    read_bge_aliases(bge_aliases, "data/bges.txt");
+}
+
+//------------------------------------------------------------------------------
+// compile the XML files into the card database: compile-db [_suffix ...]
+int compile_db(int argc, char** argv)
+{
+    std::vector<std::string> fn_suffix_list{"",};
+    for (int argIndex = 2; argIndex < argc; ++argIndex)
+    {
+        if (strncmp(argv[argIndex], "_", 1) != 0)
+        {
+            std::cerr << "Error: Unknown option " << argv[argIndex] << std::endl;
+            return 0;
+        }
+        fn_suffix_list.push_back(argv[argIndex]);
+    }
+    Cards all_cards;
+    Decks decks;
+    load_xml_data(all_cards, decks, fn_suffix_list);
+    decks.materialize_all();
+    std::string filename = card_db_filename(fn_suffix_list);
+    try
+    {
+        save_card_db(all_cards, decks, filename, card_db_sources(fn_suffix_list));
+    }
+    catch (const std::exception & e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 0;
+    }
+    std::cout << "Compiled " << all_cards.all_cards.size() << " cards and " << decks.decks.size() << " decks into " << filename << std::endl;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// measure the deck codec: bench-codec [<hash file>] [ext_b64|wmt_b64|ddd_b64]
+// decode and re-encode every hash of the file (one per line), or of random decks if no file is given
+int bench_codec(int argc, char** argv)
+{
+    DeckCodec::DeckCodec codec = DeckCodec::ext_b64;
+    std::string hash_filename;
+    for (int argIndex = 2; argIndex < argc; ++argIndex)
+    {
+        auto codec_name = std::find(deckcodec_names, deckcodec_names + DeckCodec::num_deckcodecs, argv[argIndex]);
+        if (codec_name != deckcodec_names + DeckCodec::num_deckcodecs)
+        {
+            codec = static_cast<DeckCodec::DeckCodec>(codec_name - deckcodec_names);
+        }
+        else if (hash_filename.empty())
+        {
+            hash_filename = argv[argIndex];
+        }
+        else
+        {
+            std::cerr << "Error: Unknown option " << argv[argIndex] << std::endl;
+            return 0;
+        }
+    }
+    std::vector<std::string> hashes;
+    std::vector<char> buffer(max_hash_length(max_decoded_ids));
+    if (hash_filename.empty())
+    {
+        std::mt19937 re(0);
+        std::uniform_int_distribution<unsigned> card_id(1, codec == DeckCodec::wmt_b64 ? 24000 : 60000);  // wmt_b64 ends at 6 * 4000
+        unsigned ids[11];
+        for (unsigned i = 0; i < 100000; ++ i)
+        {
+            std::generate(ids, ids + 11, [&]() { return card_id(re); });
+            std::sort(ids + 1, ids + 11);
+            hashes.emplace_back(buffer.data(), encode_ids(codec, buffer.data(), ids, 11));
+        }
+    }
+    else
+    {
+        std::ifstream hash_file(hash_filename);
+        if (!hash_file.is_open())
+        {
+            std::cerr << "Error: Hash file " << hash_filename << " could not be opened\n";
+            return 0;
+        }
+        std::string hash;
+        while (getline(hash_file, hash))
+        {
+            boost::trim(hash);
+            if (!hash.empty() && hash.compare(0, 2, "//") != 0) { hashes.push_back(hash); }
+        }
+    }
+    // check the hashes once, then time decoding all of them and encoding all of them
+    std::vector<unsigned> ids(max_decoded_ids);
+    std::vector<std::pair<size_t, size_t>> id_ranges;  // offset and number of ids of each valid hash
+    std::vector<const char*> valid_hashes;
+    size_t num_ids = 0, num_invalid = 0, num_changed = 0;
+    for (const auto & hash: hashes)
+    {
+        try
+        {
+            ids.resize(std::max(ids.size(), max_ids_in_hash(codec, hash.size())));
+            size_t n = decode_hash(codec, hash.c_str(), ids.data(), ids.size());
+            buffer.resize(std::max(buffer.size(), max_hash_length(n)));
+            if (hash.compare(0, std::string::npos, buffer.data(), encode_ids(codec, buffer.data(), ids.data(), n)) != 0) { ++ num_changed; }
+            valid_hashes.push_back(hash.c_str());
+            id_ranges.emplace_back(num_ids, n);
+            num_ids += n;
+        }
+        catch (const std::exception & e)
+        {
+            ++ num_invalid;
+        }
+    }
+    ids.resize(num_ids);
+    const unsigned rounds = std::max<size_t>(1, 10000000 / std::max<size_t>(1, num_ids));
+    size_t num_chars = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (unsigned round = 0; round < rounds; ++ round)
+    {
+        for (unsigned i = 0; i < valid_hashes.size(); ++ i)
+        {
+            decode_hash(codec, valid_hashes[i], ids.data() + id_ranges[i].first, id_ranges[i].second);
+        }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (unsigned round = 0; round < rounds; ++ round)
+    {
+        for (const auto & id_range: id_ranges)
+        {
+            num_chars += encode_ids(codec, buffer.data(), ids.data() + id_range.first, id_range.second);
+        }
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    double decode_seconds = std::chrono::duration<double>(t1 - t0).count();
+    double encode_seconds = std::chrono::duration<double>(t2 - t1).count();
+    num_ids *= rounds;
+    std::cout << "Codec " << deckcodec_names[codec] << ": " << hashes.size() << " hashes x " << rounds << " rounds, "
+        << num_invalid << " invalid, " << num_changed << " not re-encoded identically.\n";
+    std::cout << "decode: " << decode_seconds * 1e9 / std::max<size_t>(1, num_ids) << " ns/card, "
+        << "encode: " << encode_seconds * 1e9 / std::max<size_t>(1, num_ids) << " ns/card ("
+        << num_ids << " cards, " << num_chars << " chars)" << std::endl;
+    return 0;
+}
+
 //------------------------------------------------------------------------------
-int main(int argc, char** argv)
+// Data loaded once per process.
+struct LoadedData
 {
-    // only version info requested
-    // -> print out version of TUO
-	if (argc == 2 && strcmp(argv[1], "-version") == 0)
-    {
-        std::cout << "Tyrant Unleashed Optimizer " << TYRANT_OPTIMIZER_VERSION << std::endl;
-        return 0;
-    }
-	// error: must provide at least 2 parameters
-    if (argc <= 2)
+    std::vector<std::string> fn_suffix_list;
+    Cards all_cards;
+    Decks decks;
+    std::unordered_map<std::string, std::string> bge_aliases;
+};
+
+// Put back the recipes removed by disallow-recipes when the request ends.
+struct RecipeRestorer
+{
+    std::vector<std::pair<Card*, std::map<const Card*, unsigned>>> saved_recipes;
+    ~RecipeRestorer()
     {
-        usage(argc, argv);
-        return 0;
+        for (auto & it: saved_recipes)
+        {
+            it.first->m_recipe_cards = it.second;
+        }
     }
+};
+
+//------------------------------------------------------------------------------
+// Restore the options to their defaults before the next request of a resident process.
+void reset_options()
+{
+    static const std::vector<unsigned> default_max_possible_score(std::begin(max_possible_score), std::end(max_possible_score));
+    static const unsigned default_turn_limit(turn_limit);
+    gamemode = fight;
+    optimization_mode = OptimizationMode::notset;
+    owned_cards.clear();
+    use_owned_cards = true;
+    min_deck_len = 1;
+    max_deck_len = 10;
+    freezed_cards = 0;
+    fund = 0;
+    target_score = 100;
+    min_increment_of_score = 0;
+    confidence_level = 0.99;
+    use_top_level_card = false;
+    use_fused_card_level = 0;
+    show_ci = false;
+    use_harmonic_mean = false;
+    sim_seed = 0;
+    use_dominance = false;
+    dominated_cards.clear();
+    population_size = 16;
+    num_generations = 20;
+    beam_width = 4;
+    max_num_orders = 20000;
+    fork_orders = false;
+    use_lockstep = false;
+    lockstep_check = false;
+    show_early_ends = false;
+    show_histograms = false;
+    pin_threads = false;
+    json_file.close();
+    json_file.clear();
+    recipe_table.clear();
+    requirement = Requirement();
+    quest = Quest();
+    std::copy(default_max_possible_score.begin(), default_max_possible_score.end(), max_possible_score);
+    turn_limit = default_turn_limit;
+    deck_codec = DeckCodec::ext_b64;
+    debug_print = 0;
+    debug_cached = 0;
+    debug_line = false;
+    debug_str.clear();
+}
 
+//------------------------------------------------------------------------------
+// run one request: Your_Deck Enemy_Deck [Flags] [Operations]
+// - loaded: the data of a resident process, or nullptr to load the data files for this request only
+// - returns 0, or 1 if the request failed
+//------------------------------------------------------------------------------
+int run(int argc, char** argv, LoadedData* loaded)
+{
 	//init TUO
+    start_time = std::chrono::steady_clock::now();
     unsigned opt_num_threads(4);
     DeckStrategy::DeckStrategy opt_your_strategy(DeckStrategy::random);
     DeckStrategy::DeckStrategy opt_enemy_strategy(DeckStrategy::random);
@@ -1276,18 +2672,15 @@ int main(int argc, char** argv)
         // Codec
         if (strcmp(argv[argIndex], "ext_b64") == 0)
         {
-            hash_to_ids = hash_to_ids_ext_b64;
-            encode_deck = encode_deck_ext_b64;
+            deck_codec = DeckCodec::ext_b64;
         }
         else if (strcmp(argv[argIndex], "wmt_b64") == 0)
         {
-            hash_to_ids = hash_to_ids_wmt_b64;
-            encode_deck = encode_deck_wmt_b64;
+            deck_codec = DeckCodec::wmt_b64;
         }
         else if (strcmp(argv[argIndex], "ddd_b64") == 0)
         {
-            hash_to_ids = hash_to_ids_ddd_b64;
-            encode_deck = encode_deck_ddd_b64;
+            deck_codec = DeckCodec::ddd_b64;
         }
         // Base Game Mode 
 		// fight (default)	:  user deck attacks first
@@ -1385,6 +2778,8 @@ int main(int argc, char** argv)
 		// cl					: ??
 		// +ci 					: ??
 		// +hm 					: ??
+		// +dom 				: skip candidates dominated by another available card
+		// json					: append a JSON line for the initial deck, each improvement and the result to the file
 		// seed					: ??
 		// -v 					: (no output??)
 		// +v 					: (output??)
@@ -1400,6 +2795,9 @@ int main(int argc, char** argv)
 		// climbex 				: ??
 		// climb 				: simulate in climb mode, updating the deck until best deck is found (with inventory and funds)
 		// reorder 				: ??
+		// exact-reorder 		: race all distinct orders of the deck, dropping those statistically worse than the best
+		// genetic 				: evolve a population of decks (crossover + mutation), evaluating each generation as one batch
+		// beam 				: like climb, but keep the best few decks of each pass and expand all of them
 		// debug				: ??
 		// debuguntil			: output the debug info for the first battle that min_score <= score <= max_score.
         else if (strcmp(argv[argIndex], "keep-commander") == 0 || strcmp(argv[argIndex], "-c") == 0)
@@ -1515,10 +2913,69 @@ int main(int argc, char** argv)
         {
             show_ci = true;
         }
+        else if(strcmp(argv[argIndex], "+early-end") == 0)
+        {
+            show_early_ends = true;
+        }
+        else if(strcmp(argv[argIndex], "+hist") == 0)
+        {
+            show_histograms = true;
+        }
+        else if(strcmp(argv[argIndex], "+pin") == 0)
+        {
+            pin_threads = true;
+        }
         else if(strcmp(argv[argIndex], "+hm") == 0)
         {
             use_harmonic_mean = true;
         }
+        else if(strcmp(argv[argIndex], "population") == 0)
+        {
+            population_size = std::max(2, atoi(argv[argIndex+1]));
+            argIndex += 1;
+        }
+        else if(strcmp(argv[argIndex], "generations") == 0)
+        {
+            num_generations = atoi(argv[argIndex+1]);
+            argIndex += 1;
+        }
+        else if(strcmp(argv[argIndex], "beam-width") == 0)
+        {
+            beam_width = std::max(1, atoi(argv[argIndex+1]));
+            argIndex += 1;
+        }
+        else if(strcmp(argv[argIndex], "max-orders") == 0)
+        {
+            max_num_orders = atoll(argv[argIndex+1]);
+            argIndex += 1;
+        }
+        else if(strcmp(argv[argIndex], "+fork") == 0)
+        {
+            fork_orders = true;
+        }
+        else if(strcmp(argv[argIndex], "+lockstep") == 0)
+        {
+            use_lockstep = true;
+        }
+        else if(strcmp(argv[argIndex], "+lockstep-check") == 0)
+        {
+            use_lockstep = true;
+            lockstep_check = true;
+        }
+        else if(strcmp(argv[argIndex], "+dom") == 0)
+        {
+            use_dominance = true;
+        }
+        else if(strcmp(argv[argIndex], "json") == 0)
+        {
+            json_file.open(argv[argIndex + 1], std::ios::app);
+            if (!json_file.is_open())
+            {
+                std::cerr << "Error: json " << argv[argIndex + 1] << " could not be opened\n";
+                return 1;
+            }
+            argIndex += 1;
+        }
         else if(strcmp(argv[argIndex], "seed") == 0)
         {
             sim_seed = atoi(argv[argIndex+1]);
@@ -1599,6 +3056,26 @@ int main(int argc, char** argv)
             if (std::get<1>(opt_todo.back()) < 10) { opt_num_threads = 1; }
             argIndex += 1;
         }
+        else if(strcmp(argv[argIndex], "exact-reorder") == 0)
+        {
+            opt_todo.push_back(std::make_tuple((unsigned)atoi(argv[argIndex + 1]), (unsigned)atoi(argv[argIndex + 1]), exact_reorder));
+            if (std::get<1>(opt_todo.back()) < 10) { opt_num_threads = 1; }
+            argIndex += 1;
+        }
+        else if(strcmp(argv[argIndex], "genetic") == 0)
+        {
+            opt_todo.push_back(std::make_tuple((unsigned)atoi(argv[argIndex + 1]), (unsigned)atoi(argv[argIndex + 1]), genetic));
+            if (std::get<1>(opt_todo.back()) < 10) { opt_num_threads = 1; }
+            opt_do_optimization = true;
+            argIndex += 1;
+        }
+        else if(strcmp(argv[argIndex], "beam") == 0)
+        {
+            opt_todo.push_back(std::make_tuple((unsigned)atoi(argv[argIndex + 1]), (unsigned)atoi(argv[argIndex + 1]), beam));
+            if (std::get<1>(opt_todo.back()) < 10) { opt_num_threads = 1; }
+            opt_do_optimization = true;
+            argIndex += 1;
+        }
         else if(strcmp(argv[argIndex], "debug") == 0)
         {
             opt_todo.push_back(std::make_tuple(0u, 0u, debug));
@@ -1615,45 +3092,32 @@ int main(int argc, char** argv)
         else
         {
             std::cerr << "Error: Unknown option " << argv[argIndex] << std::endl;
-            return 0;
+            return 1;
         }
     }
 
-    Cards all_cards;
-    Decks decks;
-    std::unordered_map<std::string, std::string> bge_aliases;
-	
-	// load skills
-    load_skills_set_xml(all_cards, "data/skills_set.xml", true);
-	
-	// load available cards
-	for (unsigned section = 0; section <= 10; ++ section)
+    LoadedData local_data;
+    if (loaded == nullptr)
     {
-        load_cards_xml(all_cards, "data/cards_section_" + to_string(section) + ".xml", false);
+        local_data.fn_suffix_list = fn_suffix_list;
+        load_data(local_data.all_cards, local_data.decks, local_data.bge_aliases, fn_suffix_list);
+        loaded = &local_data;
     }
-	
-	// sort skills + available cards
-    all_cards.organize();	
-    
-	
-	// load available missions, raids and recipes
-	// load card abbreviations
-    for (const auto & suffix: fn_suffix_list)
+    else if (fn_suffix_list.size() == 1)
     {
-        load_decks_xml(decks, all_cards, "data/missions" + suffix + ".xml", "data/raids" + suffix + ".xml", suffix.empty());
-        load_recipes_xml(all_cards, "data/fusion_recipes_cj2" + suffix + ".xml", suffix.empty());
-        read_card_abbrs(all_cards, "data/cardabbrs" + suffix + ".txt");
+        // a request without suffixes uses those the data was loaded with
+        fn_suffix_list = loaded->fn_suffix_list;
     }
-	// load custom decks
-    for (const auto & suffix: fn_suffix_list)
+    else if (fn_suffix_list != loaded->fn_suffix_list)
     {
-        load_custom_decks(decks, all_cards, "data/customdecks" + suffix + ".txt");
+        std::cerr << "Error: File suffixes differ from those the data was loaded with; give them to daemon or batch instead.\n";
+        return 1;
     }
-	// load Battle Ground Effect (BGE) aliases
-    read_bge_aliases(bge_aliases, "data/bges.txt");
-
-	// set available skills (?? only skills that effect other cards ??)
-    fill_skill_table();
+    Cards & all_cards = loaded->all_cards;
+    Decks & decks = loaded->decks;
+    const std::unordered_map<std::string, std::string> & bge_aliases = loaded->bge_aliases;
+    std::list<Deck> request_decks;
+    RecipeRestorer recipe_restorer;
 
 	// load own inventory
     if (opt_do_optimization and use_owned_cards)
@@ -1669,10 +3133,17 @@ int main(int argc, char** argv)
                 }
             }
         }
-        for (const auto & oc_str: opt_owned_cards_str_list)
+        try
+        {
+            for (const auto & oc_str: opt_owned_cards_str_list)
+            {
+                // get details of the provided cards in the inventory
+                read_owned_cards(all_cards, owned_cards, oc_str);
+            }
+        }
+        catch (const std::exception& e)
         {
-			// get details of the provided cards in the inventory
-            read_owned_cards(all_cards, owned_cards, oc_str);
+            return 1;
         }
     }
 
@@ -1701,7 +3172,7 @@ int main(int argc, char** argv)
                         // map bge id to its value (if present otherwise zero)
                         opt_bg_effects[passive_bge_id] = (tokens.size() > 1) ? boost::lexical_cast<unsigned>(tokens[1]) : 0;
                     }
-                    else if (skill_table[skill_id] != nullptr)
+                    else if (is_activation_skill(skill_id))
                     {
                         unsigned skill_index = 1;
                         // activation BG skill
@@ -1761,19 +3232,19 @@ int main(int argc, char** argv)
                     {
                         std::cerr << "Error: unrecognized effect \"" << opt_effect << "\".\n";
                         print_available_effects();
-                        return 0;
+                        return 1;
                     }
                 }
             }
             catch (const boost::bad_lexical_cast & e)
             {
                 std::cerr << "Error: Expect a number in effect \"" << opt_effect << "\".\n";
-                return 0;
+                return 1;
             }
             catch (std::exception & e)
             {
                 std::cerr << "Error: effect \"" << opt_effect << "\": " << e.what() << ".\n";
-                return 0;
+                return 1;
             }
         }
     }
@@ -1788,12 +3259,12 @@ int main(int argc, char** argv)
 
     try
     {
-        your_deck = find_deck(decks, all_cards, your_deck_name)->clone();
+        your_deck = find_deck(decks, all_cards, your_deck_name, request_decks);
     }
     catch(const std::runtime_error& e)
     {
         std::cerr << "Error: Deck " << your_deck_name << ": " << e.what() << std::endl;
-        return 0;
+        return 1;
     }
     if(your_deck == nullptr)
     {
@@ -1807,7 +3278,7 @@ int main(int argc, char** argv)
     if(your_deck == nullptr)
     {
         usage(argc, argv);
-        return 0;
+        return 1;
     }
 
     your_deck->strategy = opt_your_strategy;
@@ -1820,7 +3291,7 @@ int main(int argc, char** argv)
         catch(const std::runtime_error& e)
         {
             std::cerr << "Error: yf " << opt_forts << ": " << e.what() << std::endl;
-            return 0;
+            return 1;
         }
     }
 
@@ -1831,7 +3302,7 @@ int main(int argc, char** argv)
     catch(const std::runtime_error& e)
     {
         std::cerr << "Error: vip " << opt_vip << ": " << e.what() << std::endl;
-        return 0;
+        return 1;
     }
 
     try
@@ -1841,7 +3312,7 @@ int main(int argc, char** argv)
     catch(const std::runtime_error& e)
     {
         std::cerr << "Error: allow-candidates " << opt_allow_candidates << ": " << e.what() << std::endl;
-        return 0;
+        return 1;
     }
 
     try
@@ -1851,7 +3322,7 @@ int main(int argc, char** argv)
     catch(const std::runtime_error& e)
     {
         std::cerr << "Error: disallow-candidates " << opt_disallow_candidates << ": " << e.what() << std::endl;
-        return 0;
+        return 1;
     }
 
     try
@@ -1859,13 +3330,15 @@ int main(int argc, char** argv)
         auto && id_dis_recipes = string_to_ids(all_cards, opt_disallow_recipes, "disallowed-recipes");
         for (auto & cid : id_dis_recipes.first)
         {
-            all_cards.cards_by_id[cid]->m_recipe_cards.clear();
+            Card* card = all_cards.cards_by_id[cid];
+            recipe_restorer.saved_recipes.emplace_back(card, card->m_recipe_cards);
+            card->m_recipe_cards.clear();
         }
     }
     catch(const std::runtime_error& e)
     {
         std::cerr << "Error: disallow-recipes " << opt_disallow_recipes << ": " << e.what() << std::endl;
-        return 0;
+        return 1;
     }
 
     if (!opt_quest.empty())
@@ -1889,7 +3362,7 @@ int main(int argc, char** argv)
                 if (skill_id == Skill::no_skill)
                 {
                     std::cerr << "Error: Expect skill in quest \"" << opt_quest << "\".\n";
-                    return 0;
+                    return 1;
                 }
                 quest.quest_type = type_str == "su" ? QuestType::skill_use : QuestType::skill_damage;
                 quest.quest_key = skill_id;
@@ -1920,7 +3393,7 @@ int main(int argc, char** argv)
                     if (quest.quest_key == 0)
                     {
                         std::cerr << "Error: Expect assault, structure or faction in quest \"" << opt_quest << "\".\n";
-                        return 0;
+                        return 1;
                     }
                 }
             }
@@ -1939,7 +3412,7 @@ int main(int argc, char** argv)
                 catch (const std::runtime_error& e)
                 {
                     std::cerr << "Error: Expect a card in quest \"" << opt_quest << "\".\n";
-                    return 0;
+                    return 1;
                 }
             }
             else if (type_str == "suoc" && tokens.size() >= 4)
@@ -1948,7 +3421,7 @@ int main(int argc, char** argv)
                 if (skill_id == Skill::no_skill)
                 {
                     std::cerr << "Error: Expect skill in quest \"" << opt_quest << "\".\n";
-                    return 0;
+                    return 1;
                 }
                 unsigned card_id;
                 unsigned card_num;
@@ -1965,7 +3438,7 @@ int main(int argc, char** argv)
                 catch (const std::runtime_error& e)
                 {
                     std::cerr << "Error: Expect a card in quest \"" << opt_quest << "\".\n";
-                    return 0;
+                    return 1;
                 }
             }
             else
@@ -1995,12 +3468,12 @@ int main(int argc, char** argv)
         catch (const boost::bad_lexical_cast & e)
         {
             std::cerr << "Error: Expect a number in quest \"" << opt_quest << "\".\n";
-            return 0;
+            return 1;
         }
         catch (const std::runtime_error& e)
         {
             std::cerr << "Error: quest " << opt_quest << ": " << e.what() << std::endl;
-            return 0;
+            return 1;
         }
     }
 
@@ -2011,7 +3484,7 @@ int main(int argc, char** argv)
     catch(const std::runtime_error& e)
     {
         std::cerr << "Error: hand " << opt_hand << ": " << e.what() << std::endl;
-        return 0;
+        return 1;
     }
 
     if (opt_keep_commander)
@@ -2035,18 +3508,18 @@ int main(int argc, char** argv)
 		Deck* enemy_deck{nullptr};
         try
         {
-            enemy_deck = find_deck(decks, all_cards, deck_parsed.first);
+            enemy_deck = find_deck(decks, all_cards, deck_parsed.first, request_decks);
         }
         catch(const std::runtime_error& e)
         {
             std::cerr << "Error: Deck " << deck_parsed.first << ": " << e.what() << std::endl;
-            return 0;
+            return 1;
         }
         if(enemy_deck == nullptr)
         {
             std::cerr << "Error: Invalid defense deck name/hash " << deck_parsed.first << ".\n";
             usage(argc, argv);
-            return 0;
+            return 1;
         }
         if (optimization_mode == OptimizationMode::notset)
         {
@@ -2074,7 +3547,7 @@ int main(int argc, char** argv)
             catch(const std::runtime_error& e)
             {
                 std::cerr << "Error: ef " << opt_enemy_forts << ": " << e.what() << std::endl;
-                return 0;
+                return 1;
             }
         }
         try
@@ -2084,12 +3557,14 @@ int main(int argc, char** argv)
         catch(const std::runtime_error& e)
         {
             std::cerr << "Error: enemy:hand " << opt_enemy_hand << ": " << e.what() << std::endl;
-            return 0;
+            return 1;
         }
         enemy_decks.push_back(enemy_deck);
         enemy_decks_factors.push_back(deck_parsed.second);
     }
 
+    build_recipe_table(all_cards);
+
     // Force to claim cards in your initial deck.
     if (opt_do_optimization and use_owned_cards)
     {
@@ -2111,6 +3586,11 @@ int main(int argc, char** argv)
     }
     freezed_cards = std::min<unsigned>(freezed_cards, your_deck->cards.size());
 
+    if (opt_do_optimization and use_dominance)
+    {
+        build_dominance_index(your_deck, all_cards, requirement, quest);
+    }
+
     if (debug_print >= 0)
     {
         std::cout << "Your Deck: " << (debug_print > 0 ? your_deck->long_description() : your_deck->medium_description()) << std::endl;
@@ -2152,6 +3632,19 @@ int main(int argc, char** argv)
             EvaluatedResults results = { EvaluatedResults::first_type(enemy_decks.size()), 0 };
             results = p.evaluate(std::get<0>(op), results);
             print_results(results, p.factors);
+            if (lockstep_check)
+            {
+                p.print_lockstep_check();
+            }
+            if (show_early_ends)
+            {
+                p.print_early_ends();
+            }
+            if (show_histograms)
+            {
+                p.print_histograms();
+            }
+            print_json_record("result", your_deck, results, p.factors);
             break;
         }
         case climb: {
@@ -2168,7 +3661,8 @@ int main(int argc, char** argv)
             }
             break;
         }
-        case reorder: {
+        case reorder:
+        case exact_reorder: {
             your_deck->strategy = DeckStrategy::ordered;
             use_owned_cards = true;
             if (min_deck_len == 1 && max_deck_len == 10)
@@ -2180,9 +3674,21 @@ int main(int argc, char** argv)
             owned_cards.clear();
             claim_cards({your_deck->commander});
             claim_cards(your_deck->cards);
+            // the index was built against the inventory, not the deck's own cards: reordering has nothing to skip
+            dominated_cards.clear();
+            if (std::get<2>(op) == exact_reorder && reorder_exhaustively(std::get<1>(op), your_deck, p))
+            { break; }
             hill_climbing_ordered(std::get<0>(op), std::get<1>(op), your_deck, p, requirement, quest);
             break;
         }
+        case genetic: {
+            genetic_search(std::get<1>(op), your_deck, p, requirement, quest);
+            break;
+        }
+        case beam: {
+            beam_climbing(std::get<1>(op), your_deck, p, requirement, quest);
+            break;
+        }
         case debug: {
             ++ debug_print;
             debug_str.clear();
@@ -2216,3 +3722,246 @@ int main(int argc, char** argv)
     }
     return 0;
 }
+
+//------------------------------------------------------------------------------
+// run one request with the loaded data; args as on the command line, without the program name; returns as run()
+int run_request(LoadedData & data, std::vector<std::string> args)
+{
+    args.insert(args.begin(), "tuo");
+    std::vector<char*> argv;
+    for (auto & arg: args)
+    {
+        argv.push_back(&arg[0]);
+    }
+    reset_options();
+    return run(argv.size(), argv.data(), &data);
+}
+
+//------------------------------------------------------------------------------
+// Answer the requests read from in, one JSON object per line, until the end of input:
+//   {"id": "1", "args": ["Your_Deck", "Enemy_Deck", "climb", "1000"]}
+// Each answer is one line: {"id": "1", "status": "ok", "output": "...", "errors": "..."}
+void serve_requests(LoadedData & data, std::istream & in, std::ostream & out)
+{
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+        {
+            continue;
+        }
+        boost::property_tree::ptree request, response;
+        std::string status("ok");
+        std::stringstream output, errors;
+        std::streambuf* cout_buf = std::cout.rdbuf(output.rdbuf());
+        std::streambuf* cerr_buf = std::cerr.rdbuf(errors.rdbuf());
+        try
+        {
+            std::istringstream request_stream(line);
+            boost::property_tree::read_json(request_stream, request);
+            std::vector<std::string> args;
+            for (const auto & arg: request.get_child("args"))
+            {
+                args.push_back(arg.second.get_value<std::string>());
+            }
+            if (args.size() < 2)
+            {
+                throw std::runtime_error("Expect Your_Deck and Enemy_Deck in args");
+            }
+            if (run_request(data, args) != 0)
+            {
+                status = "error";
+            }
+        }
+        catch (const std::exception & e)
+        {
+            status = "error";
+            errors << "Error: " << e.what() << "\n";
+        }
+        std::cout.flush();
+        std::cout.rdbuf(cout_buf);
+        std::cerr.rdbuf(cerr_buf);
+        auto id = request.get_optional<std::string>("id");
+        if (id)
+        {
+            response.put("id", *id);
+        }
+        response.put("status", status);
+        response.put("output", output.str());
+        response.put("errors", errors.str());
+        boost::property_tree::write_json(out, response, false);
+        out.flush();
+    }
+}
+
+//------------------------------------------------------------------------------
+// keep the data loaded and answer requests from stdin or a Unix domain socket:
+// daemon [_suffix ...] [socket <path>]
+int run_daemon(int argc, char** argv)
+{
+    LoadedData data;
+    data.fn_suffix_list.push_back("");
+    std::string socket_path;
+    for (int argIndex = 2; argIndex < argc; ++argIndex)
+    {
+        if (strncmp(argv[argIndex], "_", 1) == 0)
+        {
+            data.fn_suffix_list.push_back(argv[argIndex]);
+        }
+        else if (strcmp(argv[argIndex], "socket") == 0 && argIndex + 1 < argc)
+        {
+            socket_path = argv[argIndex + 1];
+            argIndex += 1;
+        }
+        else
+        {
+            std::cerr << "Error: Unknown option " << argv[argIndex] << std::endl;
+            return 0;
+        }
+    }
+    load_data(data.all_cards, data.decks, data.bge_aliases, data.fn_suffix_list);
+    if (socket_path.empty())
+    {
+        std::cerr << "Ready." << std::endl;
+        serve_requests(data, std::cin, std::cout);
+        return 0;
+    }
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    try
+    {
+        boost::asio::io_service io_service;
+        std::remove(socket_path.c_str());
+        boost::asio::local::stream_protocol::acceptor acceptor(io_service, boost::asio::local::stream_protocol::endpoint(socket_path));
+        std::cerr << "Listening on " << socket_path << std::endl;
+        while (true)
+        {
+            boost::asio::local::stream_protocol::iostream stream;
+            acceptor.accept(stream.socket());
+            serve_requests(data, stream, stream);
+        }
+    }
+    catch (const std::exception & e)
+    {
+        std::cerr << "Error: socket " << socket_path << ": " << e.what() << std::endl;
+    }
+#else
+    std::cerr << "Error: Unix domain sockets are not supported on this platform; use stdin instead.\n";
+#endif
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// run the jobs of a file, one command line (Your_Deck Enemy_Deck [Flags] [Operations]) per line:
+// batch <file> [_suffix ...] [Flags]
+// The suffixes and flags apply to every job; the job's own flags take precedence.
+int run_batch(int argc, char** argv)
+{
+    LoadedData data;
+    data.fn_suffix_list.push_back("");
+    std::vector<std::string> common_flags;
+    for (int argIndex = 3; argIndex < argc; ++argIndex)
+    {
+        if (strncmp(argv[argIndex], "_", 1) == 0)
+        {
+            data.fn_suffix_list.push_back(argv[argIndex]);
+        }
+        else
+        {
+            common_flags.push_back(argv[argIndex]);
+        }
+    }
+    std::ifstream jobs_file(argv[2]);
+    if (!jobs_file.good())
+    {
+        std::cerr << "Error: Batch file " << argv[2] << " could not be opened\n";
+        return 0;
+    }
+    load_data(data.all_cards, data.decks, data.bge_aliases, data.fn_suffix_list);
+
+    // output of the jobs run so far; a job repeated with the same arguments is not run again
+    std::map<std::vector<std::string>, std::string> job_outputs;
+    unsigned num_line(0);
+    std::string line;
+    while (std::getline(jobs_file, line))
+    {
+        ++num_line;
+        boost::trim(line);
+        if (line.empty() || strncmp(line.c_str(), "//", 2) == 0)
+        {
+            continue;
+        }
+        std::vector<std::string> args;
+        boost::tokenizer<boost::escaped_list_separator<char>> tokens{line, boost::escaped_list_separator<char>{'\\', ' ', '"'}};
+        for (const auto & token: tokens)
+        {
+            if (!token.empty())
+            {
+                args.push_back(token);
+            }
+        }
+        if (args.size() < 2)
+        {
+            std::cerr << "Error: Batch file " << argv[2] << " at line " << num_line << ": expect Your_Deck Enemy_Deck [Flags] [Operations]\n";
+            continue;
+        }
+        args.insert(args.begin() + 2, common_flags.begin(), common_flags.end());
+        auto job_output = job_outputs.find(args);
+        if (job_output == job_outputs.end())
+        {
+            std::stringstream output;
+            std::streambuf* cout_buf = std::cout.rdbuf(output.rdbuf());
+            try
+            {
+                run_request(data, args);
+            }
+            catch (const std::exception & e)
+            {
+                std::cerr << "Error: Batch file " << argv[2] << " at line " << num_line << ": " << e.what() << std::endl;
+            }
+            std::cout.flush();
+            std::cout.rdbuf(cout_buf);
+            job_output = job_outputs.emplace(args, output.str()).first;
+        }
+        std::cout << "// Job " << num_line << ": " << line << "\n" << job_output->second << std::flush;
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// main function
+// - take over parameters (param count, param values) from user input
+// - ??
+//------------------------------------------------------------------------------
+int main(int argc, char** argv)
+{
+    // only version info requested
+    // -> print out version of TUO
+	if (argc == 2 && strcmp(argv[1], "-version") == 0)
+    {
+        std::cout << "Tyrant Unleashed Optimizer " << TYRANT_OPTIMIZER_VERSION << std::endl;
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "compile-db") == 0)
+    {
+        return compile_db(argc, argv);
+    }
+    if (argc >= 2 && strcmp(argv[1], "bench-codec") == 0)
+    {
+        return bench_codec(argc, argv);
+    }
+    if (argc >= 2 && strcmp(argv[1], "daemon") == 0)
+    {
+        return run_daemon(argc, argv);
+    }
+    if (argc >= 3 && strcmp(argv[1], "batch") == 0)
+    {
+        return run_batch(argc, argv);
+    }
+	// error: must provide at least 2 parameters
+    if (argc <= 2)
+    {
+        usage(argc, argv);
+        return 0;
+    }
+    return run(argc, argv, nullptr);
+}
@@ -6,7 +6,10 @@
 #include <map>
 #include <stdexcept>
 #include <algorithm>
+#include <exception>
+#include <memory>
 #include <boost/algorithm/string.hpp>
+#include <boost/thread/thread.hpp>
 #include "rapidxml.hpp"
 #include "card.h"
 #include "cards.h"
@@ -19,19 +22,23 @@
 // mission only and test cards have no set
 using namespace rapidxml;
 
-Skill::Skill skill_name_to_id(const std::string & name)
+std::map<std::string, int> make_skill_map()
 {
-    static std::map<std::string, int> skill_map;
-    if(skill_map.empty())
+    std::map<std::string, int> skill_map;
+    for(unsigned i(0); i < Skill::num_skills; ++i)
     {
-        for(unsigned i(0); i < Skill::num_skills; ++i)
-        {
-            std::string skill_id = boost::to_lower_copy(skill_names[i]);
-            skill_map[skill_id] = i;
-        }
-        skill_map["armored"] = skill_map["armor"];  // Special case for Armor: id and name differ
-        skill_map["besiege"] = skill_map["mortar"]; // Special case for Mortar: id and name differ
+        std::string skill_id = boost::to_lower_copy(skill_names[i]);
+        skill_map[skill_id] = i;
     }
+    skill_map["armored"] = skill_map["armor"];  // Special case for Armor: id and name differ
+    skill_map["besiege"] = skill_map["mortar"]; // Special case for Mortar: id and name differ
+    return skill_map;
+}
+
+Skill::Skill skill_name_to_id(const std::string & name)
+{
+    // initialized once, safe to call from the concurrent loaders
+    static const std::map<std::string, int> skill_map(make_skill_map());
     auto x = skill_map.find(boost::to_lower_copy(name));
     if (x == skill_map.end())
     {
@@ -126,7 +133,18 @@ void parse_file(const std::string & filename, std::vector<char>& buffer, xml_doc
     }
 }
 //------------------------------------------------------------------------------
-void parse_card_node(Cards& all_cards, Card* card, xml_node<>* card_node)
+// An XML document and the buffer it has been parsed in place from.
+struct XmlFile
+{
+    std::string filename;
+    bool do_warn_on_missing;
+    std::vector<char> buffer;
+    xml_document<> doc;
+    std::exception_ptr error;
+};
+
+//------------------------------------------------------------------------------
+void parse_card_node(std::vector<Card*>& cards, Card* card, xml_node<>* card_node)
 {
     xml_node<>* id_node(card_node->first_node("id"));
     xml_node<>* card_id_node = card_node->first_node("card_id");
@@ -177,6 +195,7 @@ void parse_card_node(Cards& all_cards, Card* card, xml_node<>* card_node)
     if (card_node->first_node("skill"))
     { // inherit no skill if there is skill node
         card->m_skills.clear();
+        card->m_activation_skills.clear();
         memset(card->m_skill_value, 0, sizeof card->m_skill_value);
     }
     for(xml_node<>* skill_node = card_node->first_node("skill");
@@ -194,7 +213,7 @@ void parse_card_node(Cards& all_cards, Card* card, xml_node<>* card_node)
         bool all(skill_node->first_attribute("all"));
         card->add_skill(skill_id, x, y, n, c, s, s2, all);
     }
-    all_cards.all_cards.push_back(card);
+    cards.push_back(card);
     Card * top_card = card;
     for(xml_node<>* upgrade_node = card_node->first_node("upgrade");
             upgrade_node;
@@ -202,7 +221,7 @@ void parse_card_node(Cards& all_cards, Card* card, xml_node<>* card_node)
     {
         Card * pre_upgraded_card = top_card;
         top_card = new Card(*top_card);
-        parse_card_node(all_cards, top_card, upgrade_node);
+        parse_card_node(cards, top_card, upgrade_node);
         if (top_card->m_type == CardType::commander)
         {
             // Commanders cost twice and cannot be salvaged.
@@ -220,7 +239,7 @@ void parse_card_node(Cards& all_cards, Card* card, xml_node<>* card_node)
     card->m_top_level_card = top_card;
 }
 
-void load_cards_xml(Cards & all_cards, const std::string & filename, bool do_warn_on_missing)
+void read_cards(std::vector<Card*> & cards, const std::string & filename, bool do_warn_on_missing)
 {
     std::vector<char> buffer;
     xml_document<> doc;
@@ -236,7 +255,40 @@ void load_cards_xml(Cards & all_cards, const std::string & filename, bool do_war
         card_node = card_node->next_sibling("unit"))
     {
         auto card = new Card();
-        parse_card_node(all_cards, card, card_node);
+        parse_card_node(cards, card, card_node);
+    }
+}
+
+void load_cards_xml(Cards & all_cards, const std::string & filename, bool do_warn_on_missing)
+{
+    read_cards(all_cards.all_cards, filename, do_warn_on_missing);
+}
+
+// Parse the card files concurrently, one thread per file, into per-file card lists;
+// then append the lists in the order of filenames, as if the files were loaded one by one.
+void load_cards_xml(Cards & all_cards, const std::vector<std::string> & filenames, bool do_warn_on_missing)
+{
+    std::vector<std::vector<Card*>> cards_per_file(filenames.size());
+    std::vector<std::exception_ptr> errors(filenames.size());
+    std::vector<boost::thread> threads;
+    for (unsigned i = 0; i < filenames.size(); ++ i)
+    {
+        threads.emplace_back([&, i]()
+        {
+            try
+            { read_cards(cards_per_file[i], filenames[i], do_warn_on_missing); }
+            catch (...)
+            { errors[i] = std::current_exception(); }
+        });
+    }
+    for (auto & thread: threads) { thread.join(); }
+    for (unsigned i = 0; i < filenames.size(); ++ i)
+    {
+        all_cards.all_cards.insert(all_cards.all_cards.end(), cards_per_file[i].begin(), cards_per_file[i].end());
+    }
+    for (const auto & error: errors)
+    {
+        if (error) { std::rethrow_exception(error); }
     }
 }
 
@@ -357,13 +409,41 @@ Deck* read_deck(Decks& decks, const Cards& all_cards, xml_node<>* node, DeckType
     return deck;
 }
 //------------------------------------------------------------------------------
-void read_missions(Decks& decks, const Cards& all_cards, const std::string & filename, bool do_warn_on_missing=true)
+// Register the names read_deck would give the deck, and build it with read_deck on first lookup.
+// The builder keeps the parsed file alive.
+void add_lazy_deck(Decks& decks, const Cards& all_cards, const std::shared_ptr<XmlFile>& file, xml_node<>* node,
+        DeckType::DeckType decktype, unsigned id, const std::string & base_deck_name)
 {
-    std::vector<char> buffer;
-    xml_document<> doc;
-    parse_file(filename.c_str(), buffer, doc, do_warn_on_missing);
-    xml_node<>* root = doc.first_node();
+    xml_node<>* levels_node(node->first_node("levels"));
+    unsigned max_level = levels_node ? atoi(levels_node->value()) : 10;
+    std::vector<std::string> deck_names;
+    for (unsigned level = 1; level < max_level; ++ level)
+    {
+        deck_names.push_back(base_deck_name + "-" + to_string(level));
+        deck_names.push_back(decktype_names[decktype] + " #" + to_string(id) + "-" + to_string(level));
+    }
+    deck_names.push_back(base_deck_name);
+    deck_names.push_back(base_deck_name + "-" + to_string(max_level));
+    deck_names.push_back(decktype_names[decktype] + " #" + to_string(id));
+    deck_names.push_back(decktype_names[decktype] + " #" + to_string(id) + "-" + to_string(max_level));
+    const Cards* cards = &all_cards;
+    decks.add_lazy_deck([file, cards, node, decktype, id, base_deck_name](Decks& built)
+    {
+        try
+        {
+            read_deck(built, *cards, node, decktype, id, base_deck_name);
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::string decktype_name = boost::to_lower_copy(decktype_names[decktype]);
+            std::cerr << "Warning: Failed to parse " << decktype_name << " [" << base_deck_name << "] in file " << file->filename << ": [" << e.what() << "]. Skip the " << decktype_name << ".\n";
+        }
+    }, deck_names, decktype, id);
+}
 
+void read_missions(Decks& decks, const Cards& all_cards, const std::shared_ptr<XmlFile>& file)
+{
+    xml_node<>* root = file->doc.first_node();
     if(!root)
     {
         return;
@@ -373,31 +453,17 @@ void read_missions(Decks& decks, const Cards& all_cards, const std::string & fil
         mission_node;
         mission_node = mission_node->next_sibling("mission"))
     {
-        std::vector<unsigned> card_ids;
         xml_node<>* id_node(mission_node->first_node("id"));
         assert(id_node);
         unsigned id(id_node ? atoi(id_node->value()) : 0);
         xml_node<>* name_node(mission_node->first_node("name"));
-        std::string deck_name{name_node->value()};
-        try
-        {
-            read_deck(decks, all_cards, mission_node, DeckType::mission, id, deck_name);
-        }
-        catch (const std::runtime_error& e)
-        {
-            std::cerr << "Warning: Failed to parse mission [" << deck_name << "] in file " << filename << ": [" << e.what() << "]. Skip the mission.\n";
-            continue;
-        }
+        add_lazy_deck(decks, all_cards, file, mission_node, DeckType::mission, id, name_node->value());
     }
 }
 //------------------------------------------------------------------------------
-void read_raids(Decks& decks, const Cards& all_cards, const std::string & filename, bool do_warn_on_missing=true)
+void read_raids(Decks& decks, const Cards& all_cards, const std::shared_ptr<XmlFile>& file)
 {
-    std::vector<char> buffer;
-    xml_document<> doc;
-    parse_file(filename.c_str(), buffer, doc, do_warn_on_missing);
-    xml_node<>* root = doc.first_node();
-
+    xml_node<>* root = file->doc.first_node();
     if(!root)
     {
         return;
@@ -411,16 +477,7 @@ void read_raids(Decks& decks, const Cards& all_cards, const std::string & filena
         assert(id_node);
         unsigned id(id_node ? atoi(id_node->value()) : 0);
         xml_node<>* name_node(raid_node->first_node("name"));
-        std::string deck_name{name_node->value()};
-        try
-        {
-            read_deck(decks, all_cards, raid_node, DeckType::raid, id, deck_name);
-        }
-        catch (const std::runtime_error& e)
-        {
-            std::cerr << "Warning: Failed to parse raid [" << deck_name << "] in file " << filename << ": [" << e.what() << "]. Skip the raid.\n";
-            continue;
-        }
+        add_lazy_deck(decks, all_cards, file, raid_node, DeckType::raid, id, name_node->value());
     }
 
     for(xml_node<>* campaign_node = root->first_node("campaign");
@@ -434,27 +491,14 @@ void read_raids(Decks& decks, const Cards& all_cards, const std::string & filena
             name_node;
             name_node = name_node->next_sibling("name"))
         {
-            try
-            {
-                read_deck(decks, all_cards, campaign_node, DeckType::campaign, id, name_node->value());
-            }
-            catch (const std::runtime_error& e)
-            {
-                std::cerr << "Warning: Failed to parse campaign [" << name_node->value() << "] in file " << filename << ": [" << e.what() << "]. Skip the campaign.\n";
-                continue;
-            }
+            add_lazy_deck(decks, all_cards, file, campaign_node, DeckType::campaign, id, name_node->value());
         }
     }
 }
 
 //------------------------------------------------------------------------------
-void load_recipes_xml(Cards& all_cards, const std::string & filename, bool do_warn_on_missing=true)
+void read_recipes(Cards& all_cards, xml_node<>* root)
 {
-    std::vector<char> buffer;
-    xml_document<> doc;
-    parse_file(filename, buffer, doc, do_warn_on_missing);
-    xml_node<>* root = doc.first_node();
-
     if(!root)
     {
         return;
@@ -487,3 +531,90 @@ void load_recipes_xml(Cards& all_cards, const std::string & filename, bool do_wa
     }
 }
 
+//------------------------------------------------------------------------------
+void read_missions(Decks& decks, const Cards& all_cards, const std::string & filename, bool do_warn_on_missing=true)
+{
+    std::shared_ptr<XmlFile> file(new XmlFile);
+    file->filename = filename;
+    parse_file(filename, file->buffer, file->doc, do_warn_on_missing);
+    read_missions(decks, all_cards, file);
+}
+
+void read_raids(Decks& decks, const Cards& all_cards, const std::string & filename, bool do_warn_on_missing=true)
+{
+    std::shared_ptr<XmlFile> file(new XmlFile);
+    file->filename = filename;
+    parse_file(filename, file->buffer, file->doc, do_warn_on_missing);
+    read_raids(decks, all_cards, file);
+}
+
+void load_recipes_xml(Cards& all_cards, const std::string & filename, bool do_warn_on_missing=true)
+{
+    std::vector<char> buffer;
+    xml_document<> doc;
+    parse_file(filename, buffer, doc, do_warn_on_missing);
+    read_recipes(all_cards, doc.first_node());
+}
+
+// Read and parse the files concurrently, one thread per file.
+void parse_files_concurrently(std::vector<std::shared_ptr<XmlFile>> & files)
+{
+    std::vector<boost::thread> threads;
+    for (auto & file: files)
+    {
+        XmlFile * f = file.get();
+        threads.emplace_back([f]()
+        {
+            try
+            { parse_file(f->filename, f->buffer, f->doc, f->do_warn_on_missing); }
+            catch (...)
+            { f->error = std::current_exception(); }
+        });
+    }
+    for (auto & thread: threads) { thread.join(); }
+}
+
+// Read and parse the mission, raid and recipe files concurrently,
+// then build the decks and recipes in the same order as load_decks_xml + load_recipes_xml per file set.
+// Only the first file set warns on missing files.
+void load_decks_and_recipes_xml(Decks& decks, Cards& all_cards, const std::vector<std::string> & mission_filenames,
+        const std::vector<std::string> & raid_filenames, const std::vector<std::string> & recipe_filenames)
+{
+    std::vector<std::shared_ptr<XmlFile>> files;
+    for (unsigned i = 0; i < mission_filenames.size(); ++ i)
+    {
+        for (const auto & filename: {mission_filenames[i], raid_filenames[i], recipe_filenames[i]})
+        {
+            files.emplace_back(new XmlFile);
+            files.back()->filename = filename;
+            files.back()->do_warn_on_missing = (i == 0);
+        }
+    }
+    parse_files_concurrently(files);
+    for (unsigned i = 0; i < files.size(); i += 3)
+    {
+        const std::shared_ptr<XmlFile> & missions = files[i];
+        const std::shared_ptr<XmlFile> & raids = files[i + 1];
+        XmlFile & recipes = *files[i + 2];
+        try
+        {
+            if (missions->error) { std::rethrow_exception(missions->error); }
+            read_missions(decks, all_cards, missions);
+        }
+        catch (const rapidxml::parse_error& e)
+        {
+            std::cerr << "\nFailed to parse file [" << missions->filename << "]. Skip it.\n";
+        }
+        try
+        {
+            if (raids->error) { std::rethrow_exception(raids->error); }
+            read_raids(decks, all_cards, raids);
+        }
+        catch (const rapidxml::parse_error& e)
+        {
+            std::cerr << "\nFailed to parse file [" << raids->filename << "]. Skip it.\n";
+        }
+        if (recipes.error) { std::rethrow_exception(recipes.error); }
+        read_recipes(all_cards, recipes.doc.first_node());
+    }
+}
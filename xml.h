@@ -2,6 +2,7 @@
 #define XML_H_INCLUDED
 
 #include <string>
+#include <vector>
 #include "tyrant.h"
 
 class Cards;
@@ -10,9 +11,12 @@ class Achievement;
 
 Skill::Skill skill_name_to_id(const std::string & name);
 void load_cards_xml(Cards & all_cards, const std::string & filename, bool do_warn_on_missing);
+void load_cards_xml(Cards & all_cards, const std::vector<std::string> & filenames, bool do_warn_on_missing);
 void load_skills_set_xml(Cards & all_cards, const std::string & filename, bool do_warn_on_missing);
 void load_decks_xml(Decks& decks, const Cards& all_cards, const std::string & mission_filename, const std::string & raid_filename, bool do_warn_on_missing);
 void load_recipes_xml(Cards& all_cards, const std::string & filename, bool do_warn_on_missing);
+void load_decks_and_recipes_xml(Decks& decks, Cards& all_cards, const std::vector<std::string> & mission_filenames,
+        const std::vector<std::string> & raid_filenames, const std::vector<std::string> & recipe_filenames);
 void read_missions(Decks& decks, const Cards& all_cards, const std::string & filename, bool do_warn_on_missing);
 void read_raids(Decks& decks, const Cards& all_cards, const std::string & filename, bool do_warn_on_missing);
 